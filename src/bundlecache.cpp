@@ -0,0 +1,646 @@
+#include "bundlecache.h"
+#include "plistreader.h"
+
+#include <QtCore/QBitArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QVector>
+#include <QtGui/QDesktopServices>
+
+#include <QtDebug>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
+
+namespace {
+
+/*
+  The cache file is made of 32-bit words in host byte order:
+
+    Header
+    StringEntry[stringCount]    UTF-16 data of the strings, by id
+    FileEntry[fileCount]        The files cached, and where their values are
+    values                      Tagged words, see ValueTag
+    string data
+
+  Offsets are in bytes from the start of the file. A file from a host with
+  another byte order, or from another version, fails the header check and
+  is written again.
+  */
+
+const quint32 Magic = 0x43424c54;   // "TLBC"
+const quint32 Version = 1;
+
+// Deeper nesting is taken as a broken file, as in PlistStream
+const int MaxDepth = 512;
+
+struct Header {
+    quint32 magic;
+    quint32 version;
+    quint32 stringCount;
+    quint32 stringTable;
+    quint32 fileCount;
+    quint32 fileTable;
+};
+
+struct StringEntry {
+    quint32 offset;
+    quint32 length;
+};
+
+struct FileEntry {
+    qint64 size;
+    qint64 modified;
+    quint32 path;       // String id
+    quint32 value;      // Offset of the value
+};
+
+/**
+  * Each value is a tag word followed by:
+  *   String: the string id
+  *   Integer: the value
+  *   Array: the number of elements, and the elements
+  *   Dict: the number of entries, and a key string id and value for each
+  */
+enum ValueTag {
+    InvalidValue,
+    StringValue,
+    IntegerValue,
+    ArrayValue,
+    DictValue
+};
+
+QString _CacheFileName(const QString& path)
+{
+    QString dir = QDesktopServices::storageLocation(QDesktopServices::CacheLocation) + "/bundles";
+    QString key = QFileInfo(path).absoluteFilePath();
+    return QString("%1/%2.cache").arg(dir).arg(qHash(key), 8, 16, QLatin1Char('0'));
+}
+
+qint64 _ModificationTime(const QFileInfo& info)
+{
+    return info.lastModified().toMSecsSinceEpoch();
+}
+
+/**
+  * Moves a file over another in one step. QFile::rename() doesn't replace
+  * an existing file.
+  */
+bool _ReplaceFile(const QString& from, const QString& to)
+{
+#if defined(Q_OS_WIN)
+    return MoveFileExW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(from).utf16()),
+                       reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(to).utf16()),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return ::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+/**
+  * Writes a new file under a name of its own and moves it in place, so the
+  * cache file is always complete, and a cache file being read by another
+  * instance stays intact
+  */
+bool _WriteFile(const QString& fileName, const QByteArray& bytes)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QTemporaryFile temp(fileName + ".XXXXXX");
+    if (!temp.open() || temp.write(bytes) != bytes.size()) {
+        qWarning() << "Can't write bundle cache" << temp.fileName();
+        return false;
+    }
+    temp.close();
+    if (!_ReplaceFile(temp.fileName(), fileName)) {
+        qWarning() << "Can't write bundle cache" << fileName;
+        return false;
+    }
+    return true;
+}
+
+/**
+  * Strings by id, each stored once
+  */
+class StringTable
+{
+public:
+    QVector<QString> strings;
+
+    quint32 intern(const QString& str)
+    {
+        QHash<QString, quint32>::const_iterator it = ids.constFind(str);
+        if (it != ids.constEnd())
+            return it.value();
+        strings.append(str);
+        ids.insert(str, strings.size() - 1);
+        return strings.size() - 1;
+    }
+
+private:
+    QHash<QString, quint32> ids;
+};
+
+/**
+  * Writes the value just moved to in the stream as tagged words
+  */
+void _Encode(PlistStream& stream, PlistStream::Type type, StringTable& strings, QVector<quint32>& words)
+{
+    switch (type) {
+    case PlistStream::String:
+        words.append(StringValue);
+        words.append(strings.intern(stream.text()));
+        break;
+    case PlistStream::Integer:
+        words.append(IntegerValue);
+        words.append(quint32(stream.integer()));
+        break;
+    case PlistStream::Array:
+    case PlistStream::Dict: {
+        const bool dict = type == PlistStream::Dict;
+        words.append(dict ? DictValue : ArrayValue);
+        const int count = words.size();
+        words.append(0);
+        while ((type = stream.next()) != PlistStream::End) {
+            if (dict)
+                words.append(strings.intern(stream.key()));
+            _Encode(stream, type, strings, words);
+            words[count]++;
+        }
+        break;
+    }
+    default:
+        words.append(InvalidValue);
+        break;
+    }
+}
+
+/**
+  * Moves past a valid value
+  */
+void _SkipValue(const quint32*& p)
+{
+    const quint32 tag = *p++;
+    switch (tag) {
+    case StringValue:
+    case IntegerValue:
+        ++p;
+        break;
+    case ArrayValue:
+    case DictValue: {
+        const quint32 count = *p++;
+        for (quint32 i = 0; i < count; ++i) {
+            if (tag == DictValue)
+                ++p;
+            _SkipValue(p);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+}
+
+class BundleCachePrivate
+{
+    friend class BundleCache;
+    friend class BundleCacheStream;
+
+    struct Entry {
+        qint64 size;
+        qint64 modified;
+
+        // The value is either in the cache file, or in words if the file
+        // was read again. Values read again have their own strings, so files
+        // can be read in parallel.
+        bool cached;
+        quint32 value;
+        QVector<quint32> words;
+        QVector<QString> strings;
+    };
+
+    BundleCachePrivate() : data(0), size(0), header(0), changed(false) {}
+
+    bool open();
+    void close();
+
+    const FileEntry& fileEntry(quint32 index) const;
+    const quint32* value(quint32 offset) const;
+    const quint32* valuesEnd() const;
+    QString cachedString(quint32 id);
+    QString entryString(const Entry& entry, quint32 id);
+
+    bool isValidValue(const quint32*& p, const quint32* end, int depth = 0) const;
+    void copyValue(const quint32*& p, const Entry& entry, StringTable& strings, QVector<quint32>& words);
+
+    QString fileName;
+    QFile file;
+    const uchar* data;
+    qint64 size;
+    const Header* header;
+
+    // Indexes into the file table by absolute path
+    QHash<QString, quint32> cachedFiles;
+
+    // Guards the members below, which are changed by read()
+    QMutex mutex;
+
+    // Strings of the cache file, decoded on first use
+    QVector<QString> cachedStrings;
+    QBitArray decoded;
+
+    // The files read, to be written by save()
+    QMap<QString, Entry> entries;
+    bool changed;
+};
+
+/**
+  * Streams a value from the cache file, or one read again
+  */
+class BundleCacheStream : public PlistStream
+{
+public:
+    BundleCacheStream(BundleCachePrivate* cache, const quint32* value)
+        : cache(cache), fresh(false), p(value), started(false), currentInteger(0) {}
+
+    BundleCacheStream(const QVector<quint32>& words, const QVector<QString>& strings)
+        : cache(0), fresh(true), words(words), strings(strings), p(this->words.constData()),
+          started(false), currentInteger(0) {}
+
+    Type next();
+    void skip();
+
+    QString key() const { return currentKey; }
+    QString text() const { return currentText; }
+    int integer() const { return currentInteger; }
+
+private:
+    struct Level {
+        quint32 remaining;
+        bool dict;
+    };
+
+    QString string(quint32 id) const
+    {
+        return fresh ? strings.at(id) : cache->cachedString(id);
+    }
+
+    BundleCachePrivate* cache;
+    bool fresh;
+    QVector<quint32> words;
+    QVector<QString> strings;
+    const quint32* p;
+
+    bool started;
+    QVector<Level> levels;
+
+    QString currentKey;
+    QString currentText;
+    int currentInteger;
+};
+
+PlistStream::Type BundleCacheStream::next()
+{
+    // Values were checked by isValidValue() before streaming
+    if (levels.isEmpty()) {
+        if (started)
+            return End;
+        started = true;
+        currentKey.clear();
+    } else {
+        Level& level = levels.last();
+        if (level.remaining == 0) {
+            levels.pop_back();
+            return End;
+        }
+        level.remaining--;
+        currentKey = level.dict ? string(*p++) : QString();
+    }
+
+    switch (*p++) {
+    case StringValue:
+        currentText = string(*p++);
+        return String;
+    case IntegerValue:
+        currentInteger = int(*p++);
+        return Integer;
+    case ArrayValue:
+    case DictValue: {
+        Level level;
+        level.dict = p[-1] == DictValue;
+        level.remaining = *p++;
+        levels.append(level);
+        return level.dict ? Dict : Array;
+    }
+    default:
+        return Unknown;
+    }
+}
+
+/**
+  * Skips the children without looking up their strings
+  */
+void BundleCacheStream::skip()
+{
+    const Level level = levels.last();
+    levels.pop_back();
+    for (quint32 i = 0; i < level.remaining; ++i) {
+        if (level.dict)
+            ++p;
+        _SkipValue(p);
+    }
+}
+
+bool BundleCachePrivate::open()
+{
+    file.setFileName(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    size = file.size();
+    if (size < qint64(sizeof(Header)) || size > 0x7fffffff)
+        return false;
+    data = file.map(0, size);
+    if (!data)
+        return false;
+
+    header = reinterpret_cast<const Header*>(data);
+    if (header->magic != Magic || header->version != Version)
+        return false;
+    if (header->stringTable + quint64(header->stringCount) * sizeof(StringEntry) > quint64(size)
+            || header->fileTable + quint64(header->fileCount) * sizeof(FileEntry) > quint64(size)
+            || header->stringTable % 4 || header->fileTable % 8)
+        return false;
+
+    cachedStrings.resize(header->stringCount);
+    decoded = QBitArray(header->stringCount);
+
+    for (quint32 i = 0; i < header->fileCount; ++i) {
+        if (fileEntry(i).path >= header->stringCount)
+            return false;
+        cachedFiles.insert(cachedString(fileEntry(i).path), i);
+    }
+    return true;
+}
+
+void BundleCachePrivate::close()
+{
+    if (data)
+        file.unmap(const_cast<uchar*>(data));
+    file.close();
+    data = 0;
+    size = 0;
+    header = 0;
+    cachedStrings.clear();
+    decoded.clear();
+    cachedFiles.clear();
+}
+
+const FileEntry& BundleCachePrivate::fileEntry(quint32 index) const
+{
+    return reinterpret_cast<const FileEntry*>(data + header->fileTable)[index];
+}
+
+/**
+  * Returns the value at offset in the cache file, or 0 if it's not a valid
+  * offset
+  */
+const quint32* BundleCachePrivate::value(quint32 offset) const
+{
+    if (offset % 4 || offset >= size)
+        return 0;
+    return reinterpret_cast<const quint32*>(data + offset);
+}
+
+const quint32* BundleCachePrivate::valuesEnd() const
+{
+    return reinterpret_cast<const quint32*>(data + (size & ~3));
+}
+
+QString BundleCachePrivate::cachedString(quint32 id)
+{
+    QMutexLocker locker(&mutex);
+    if (!decoded.testBit(id)) {
+        const StringEntry& entry = reinterpret_cast<const StringEntry*>(data + header->stringTable)[id];
+        if (entry.offset % 2 == 0 && entry.offset + quint64(entry.length) * 2 <= quint64(size))
+            cachedStrings[id] = QString(reinterpret_cast<const QChar*>(data + entry.offset), entry.length);
+        decoded.setBit(id);
+    }
+    return cachedStrings.at(id);
+}
+
+QString BundleCachePrivate::entryString(const Entry& entry, quint32 id)
+{
+    return entry.cached ? cachedString(id) : entry.strings.at(id);
+}
+
+/**
+  * Checks the value at p in the cache file, and moves past it. Nesting
+  * deeper than MaxDepth is taken as a broken file.
+  */
+bool BundleCachePrivate::isValidValue(const quint32*& p, const quint32* end, int depth) const
+{
+    if (p == end)
+        return false;
+
+    const quint32 tag = *p++;
+    switch (tag) {
+    case InvalidValue:
+        return true;
+    case StringValue:
+        return p != end && *p++ < header->stringCount;
+    case IntegerValue:
+        if (p == end)
+            return false;
+        ++p;
+        return true;
+    case ArrayValue:
+    case DictValue: {
+        if (p == end || depth == MaxDepth)
+            return false;
+        const quint32 count = *p++;
+        for (quint32 i = 0; i < count; ++i) {
+            if (tag == DictValue && (p == end || *p++ >= header->stringCount))
+                return false;
+            if (!isValidValue(p, end, depth + 1))
+                return false;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/**
+  * Copies a valid value of entry, with its strings in strings
+  */
+void BundleCachePrivate::copyValue(const quint32*& p, const Entry& entry, StringTable& strings,
+                                   QVector<quint32>& words)
+{
+    const quint32 tag = *p++;
+    words.append(tag);
+    switch (tag) {
+    case StringValue:
+        words.append(strings.intern(entryString(entry, *p++)));
+        break;
+    case IntegerValue:
+        words.append(*p++);
+        break;
+    case ArrayValue:
+    case DictValue: {
+        const quint32 count = *p++;
+        words.append(count);
+        for (quint32 i = 0; i < count; ++i) {
+            if (tag == DictValue)
+                words.append(strings.intern(entryString(entry, *p++)));
+            copyValue(p, entry, strings, words);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+BundleCache::BundleCache(const QString& path)
+    : d(new BundleCachePrivate)
+{
+    d->fileName = _CacheFileName(path);
+    if (QFile::exists(d->fileName) && !d->open()) {
+        qWarning() << "Ignoring invalid bundle cache" << d->fileName;
+        d->close();
+    }
+}
+
+BundleCache::~BundleCache()
+{
+    // Files that changed were read again, and files that are gone weren't
+    // read at all
+    if (isModified())
+        save();
+}
+
+PlistStream* BundleCache::read(const QString& path)
+{
+    QFileInfo info(path);
+    QString key = info.absoluteFilePath();
+
+    BundleCachePrivate::Entry entry;
+    entry.size = info.size();
+    entry.modified = _ModificationTime(info);
+    entry.cached = false;
+    entry.value = 0;
+
+    QHash<QString, quint32>::const_iterator it = d->cachedFiles.constFind(key);
+    if (it != d->cachedFiles.constEnd()) {
+        const FileEntry& cached = d->fileEntry(it.value());
+        if (cached.size == entry.size && cached.modified == entry.modified) {
+            const quint32* value = d->value(cached.value);
+            const quint32* p = value;
+            if (value && d->isValidValue(p, d->valuesEnd())) {
+                entry.cached = true;
+                entry.value = cached.value;
+                QMutexLocker locker(&d->mutex);
+                d->entries.insert(key, entry);
+                return new BundleCacheStream(d.data(), value);
+            }
+            qWarning() << "Invalid bundle cache entry for" << key;
+        }
+    }
+
+    QScopedPointer<PlistStream> stream(PlistStream::open(path));
+    StringTable strings;
+    _Encode(*stream, stream->next(), strings, entry.words);
+    if (stream->hasError()) {
+        entry.words.clear();
+        entry.words.append(InvalidValue);
+    }
+    entry.strings = strings.strings;
+
+    QMutexLocker locker(&d->mutex);
+    d->entries.insert(key, entry);
+    d->changed = true;
+    return new BundleCacheStream(entry.words, entry.strings);
+}
+
+bool BundleCache::isModified() const
+{
+    return d->changed || d->entries.size() != d->cachedFiles.size();
+}
+
+bool BundleCache::save()
+{
+    StringTable strings;
+    QVector<FileEntry> files;
+    QVector<quint32> words;
+    QMap<QString, BundleCachePrivate::Entry>::const_iterator it;
+    for (it = d->entries.constBegin(); it != d->entries.constEnd(); ++it) {
+        FileEntry file;
+        file.size = it.value().size;
+        file.modified = it.value().modified;
+        file.path = strings.intern(it.key());
+        file.value = words.size();
+        const quint32* p = it.value().cached ? d->value(it.value().value) : it.value().words.constData();
+        d->copyValue(p, it.value(), strings, words);
+        files.append(file);
+    }
+
+    Header header;
+    header.magic = Magic;
+    header.version = Version;
+    header.stringCount = strings.strings.size();
+    header.stringTable = sizeof(Header);
+    header.fileCount = files.size();
+    header.fileTable = header.stringTable + header.stringCount * sizeof(StringEntry);
+
+    const quint32 valuesOffset = header.fileTable + header.fileCount * sizeof(FileEntry);
+    for (int i = 0; i < files.size(); ++i)
+        files[i].value = valuesOffset + files[i].value * sizeof(quint32);
+
+    QVector<StringEntry> stringTable(header.stringCount);
+    quint32 offset = valuesOffset + words.size() * sizeof(quint32);
+    for (quint32 i = 0; i < header.stringCount; ++i) {
+        stringTable[i].offset = offset;
+        stringTable[i].length = strings.strings.at(i).size();
+        offset += stringTable[i].length * sizeof(QChar);
+    }
+
+    QByteArray bytes;
+    bytes.reserve(offset);
+    bytes.append(reinterpret_cast<const char*>(&header), sizeof(Header));
+    bytes.append(reinterpret_cast<const char*>(stringTable.constData()), stringTable.size() * sizeof(StringEntry));
+    bytes.append(reinterpret_cast<const char*>(files.constData()), files.size() * sizeof(FileEntry));
+    bytes.append(reinterpret_cast<const char*>(words.constData()), words.size() * sizeof(quint32));
+    foreach (const QString& str, strings.strings)
+        bytes.append(reinterpret_cast<const char*>(str.constData()), str.size() * sizeof(QChar));
+
+    d->close();
+    bool written = _WriteFile(d->fileName, bytes);
+
+    // The files read are all in the new cache file now
+    if (written && d->open()) {
+        QMap<QString, BundleCachePrivate::Entry>::iterator entry = d->entries.begin();
+        for (int i = 0; i < files.size(); ++i, ++entry) {
+            entry.value().cached = true;
+            entry.value().value = files.at(i).value;
+            entry.value().words.clear();
+            entry.value().strings.clear();
+        }
+    } else {
+        d->close();
+        d->entries.clear();
+    }
+    d->changed = false;
+    return written;
+}
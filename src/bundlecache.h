@@ -0,0 +1,74 @@
+#ifndef BUNDLECACHE_H
+#define BUNDLECACHE_H
+
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+
+class BundleCachePrivate;
+class PlistStream;
+
+/**
+  * A binary copy of the plist files in a directory, kept in a cache file so
+  * they don't have to be parsed as XML on every start.
+  *
+  * The cache file is mapped into memory, and each file's data is streamed
+  * from it when asked for. Strings are stored once and shared by all the
+  * data read, so a scope name or a key like "match" is the same QString
+  * everywhere. A file's data is used as long as the file has the size and
+  * modification time it had when cached, and read again otherwise.
+  *
+  * read() can be called from several threads at once, but not while save()
+  * runs.
+  */
+class BundleCache
+{
+public:
+    /**
+      * Opens the cache for the plist files under path
+      */
+    explicit BundleCache(const QString& path);
+
+    /**
+      * Writes the cache back if anything was read again
+      */
+    ~BundleCache();
+
+    /**
+      * Returns a stream over the contents of a plist file, from the cache if
+      * the file hasn't changed since it was cached. The caller takes
+      * ownership, and must delete the stream before the cache.
+      */
+    PlistStream* read(const QString& path);
+
+    /**
+      * Writes the files read so far to the cache file, dropping files that
+      * weren't read. Returns false if the cache file couldn't be written.
+      */
+    bool save();
+
+    /**
+      * Returns true if the cache file is out of date, because files were
+      * read again, or cached files weren't read
+      */
+    bool isModified() const;
+
+private:
+    QScopedPointer<BundleCachePrivate> d;
+};
+
+/**
+  * A plist file in a bundle, to be read when it's needed, through the cache
+  * of its directory
+  */
+struct BundleFile {
+    QString path;
+    QSharedPointer<BundleCache> cache;
+
+    /**
+      * Returns a stream over the file, which the caller must delete
+      */
+    PlistStream* read() const { return cache->read(path); }
+};
+
+#endif // BUNDLECACHE_H
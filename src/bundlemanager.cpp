@@ -1,21 +1,69 @@
 #include "bundlemanager.h"
+#include "bundlecache.h"
 #include "highlighter.h"
-#include "theme.h"
 #include "plistreader.h"
+#include "preferences.h"
+#include "syntaxdata.h"
+#include "theme.h"
 
 #include <QDir>
+#include <QtConcurrentMap>
 
 #include <QtDebug>
 
+namespace {
+
+/**
+  * Reads a plist file into T, with a function like T::read()
+  */
+template <typename T>
+class PlistFileReader
+{
+public:
+    typedef T result_type;
+    typedef T (*ReadFunction)(PlistStream& stream);
+
+    PlistFileReader(BundleCache* cache, ReadFunction read) : cache(cache), read(read) {}
+
+    T operator()(const QString& path) const
+    {
+        QScopedPointer<PlistStream> stream(cache->read(path));
+        return read(*stream);
+    }
+
+private:
+    BundleCache* cache;
+    ReadFunction read;
+};
+
+/**
+  * Reads the plist files into T, on the global thread pool. The results are
+  * in the same order as the files.
+  */
+template <typename T>
+QList<T> _ReadFiles(BundleCache& cache, const QStringList& paths, T (*read)(PlistStream&))
+{
+    return QtConcurrent::blockingMapped<QList<T> >(paths, PlistFileReader<T>(&cache, read));
+}
+
+}
+
 class BundleManagerPrivate
 {
     friend class BundleManager;
 
     Theme theme;
 
+    // Only the names of themes and grammars are read at first, the files
+    // are read when they're used
     QMap<QString, QString> fileTypes;
-    QMap<QString, QVariantMap> themeData;
-    QMap<QString, QVariantMap> syntaxData;
+    QMap<QString, BundleFile> themeFiles;
+    QMap<QString, BundleFile> syntaxFiles;
+    Grammar grammar;
+
+    // Preference files are small, and read at once
+    QList<PreferenceData> preferenceData;
+    Preferences preferences;
 };
 
 BundleManager::BundleManager(QObject *parent) :
@@ -35,21 +83,29 @@ Theme BundleManager::theme() const
 
 QStringList BundleManager::themeNames() const
 {
-    return d->themeData.keys();
+    return d->themeFiles.keys();
 }
 
 void BundleManager::readThemes(const QString& path)
 {
     QDir themeDir(path);
     themeDir.setFilter(QDir::Files);
-    themeDir.setNameFilters(QStringList() << "*.tmTheme");
+    themeDir.setNameFilters(QStringList() << "*.tmTheme" << "*.tmTheme.json");
+    QStringList themeFilePaths;
     foreach (QString themeFileName, themeDir.entryList()) {
-        QString themeFilePath = path + "/" + themeFileName;
-        PlistReader reader;
-        QVariantMap themeData = reader.read(themeFilePath).toMap();
-        QString themeName = themeData["name"].toString();
-        if (!themeName.isEmpty()) {
-            d->themeData[themeName] = themeData;
+        themeFilePaths << path + "/" + themeFileName;
+    }
+    QSharedPointer<BundleCache> cache(new BundleCache(path));
+    QList<ThemeData> themes = _ReadFiles(*cache, themeFilePaths, &ThemeData::readHeader);
+    if (cache->isModified()) {
+        cache->save();
+    }
+    for (int i = 0; i < themes.size(); i++) {
+        if (!themes.at(i).name.isEmpty()) {
+            BundleFile file;
+            file.path = themeFilePaths.at(i);
+            file.cache = cache;
+            d->themeFiles[themes.at(i).name] = file;
         }
     }
 }
@@ -59,6 +115,8 @@ void BundleManager::readBundles(const QString &path)
     QDir bundleDir(path);
     bundleDir.setFilter(QDir::Dirs);
     bundleDir.setNameFilters(QStringList() << "*.tmbundle");
+    QStringList syntaxFiles;
+    QStringList preferenceFiles;
     foreach (QString bundleName, bundleDir.entryList()) {
         QString bundlePath = bundleDir.filePath(bundleName);
         QDir syntaxDir(bundlePath + "/Syntaxes");
@@ -67,25 +125,68 @@ void BundleManager::readBundles(const QString &path)
             QStringList nameFilters;
             nameFilters << "*.plist";
             nameFilters << "*.tmLanguage";
+            nameFilters << "*.tmLanguage.json";
             syntaxDir.setNameFilters(nameFilters);
             foreach (QString file, syntaxDir.entryList()) {
-                QString syntaxFile = syntaxDir.filePath(file);
-                PlistReader reader;
-                QVariantMap syntaxData = reader.read(syntaxFile).toMap();
-                QString scopeName = syntaxData.value("scopeName").toString();
-                d->syntaxData[scopeName] = syntaxData;
-                QVariantList fileTypes = syntaxData.value("fileTypes").toList();
-                foreach (QVariant type, fileTypes) {
-                    d->fileTypes[type.toString()] = scopeName;
-                }
+                syntaxFiles << syntaxDir.filePath(file);
+            }
+        }
+        QDir preferenceDir(bundlePath + "/Preferences");
+        if (preferenceDir.exists()) {
+            preferenceDir.setFilter(QDir::Files);
+            QStringList nameFilters;
+            nameFilters << "*.plist";
+            nameFilters << "*.tmPreferences";
+            nameFilters << "*.tmPreferences.json";
+            preferenceDir.setNameFilters(nameFilters);
+            foreach (QString file, preferenceDir.entryList()) {
+                preferenceFiles << preferenceDir.filePath(file);
             }
         }
     }
+
+    // The files are read in parallel, and merged in order, so the last
+    // grammar for a scope name or file type wins, as before
+    QSharedPointer<BundleCache> cache(new BundleCache(path));
+    QList<SyntaxData> syntaxes = _ReadFiles(*cache, syntaxFiles, &SyntaxData::readHeader);
+    d->preferenceData += _ReadFiles(*cache, preferenceFiles, &PreferenceData::read);
+
+    // Saved before the grammars can read from it on other threads
+    if (cache->isModified()) {
+        cache->save();
+    }
+    for (int i = 0; i < syntaxes.size(); i++) {
+        const SyntaxData& syntaxData = syntaxes.at(i);
+        BundleFile file;
+        file.path = syntaxFiles.at(i);
+        file.cache = cache;
+        d->syntaxFiles[syntaxData.scopeName] = file;
+        foreach (const QString& type, syntaxData.fileTypes) {
+            d->fileTypes[type] = syntaxData.scopeName;
+        }
+    }
+    d->grammar.setSyntaxFiles(d->syntaxFiles);
+    d->preferences.setPreferenceData(d->preferenceData);
+}
+
+Grammar BundleManager::grammar() const
+{
+    return d->grammar;
+}
+
+Preferences BundleManager::preferences() const
+{
+    return d->preferences;
 }
 
-QMap<QString, QVariantMap> BundleManager::getSyntaxData() const
+QStringList BundleManager::scopeNames() const
 {
-    return d->syntaxData;
+    return d->syntaxFiles.keys();
+}
+
+QString BundleManager::scopeNameForExtension(const QString& extension) const
+{
+    return d->fileTypes.value(extension);
 }
 
 Highlighter* BundleManager::getHighlighterForExtension(const QString& extension, QTextDocument* document)
@@ -101,6 +202,11 @@ Highlighter* BundleManager::getHighlighterForExtension(const QString& extension,
 
 void BundleManager::setThemeName(const QString& themeName)
 {
-    d->theme.setThemeData(d->themeData[themeName]);
+    ThemeData themeData;
+    if (d->themeFiles.contains(themeName)) {
+        QScopedPointer<PlistStream> stream(d->themeFiles.value(themeName).read());
+        themeData = ThemeData::read(*stream);
+    }
+    d->theme.setThemeData(themeData);
     emit themeChanged(d->theme);
 }
@@ -5,6 +5,9 @@
 #include <QScopedPointer>
 #include <QVariant>
 
+#include "grammar.h"
+
+class Preferences;
 class Theme;
 class Highlighter;
 class QTextDocument;
@@ -24,7 +27,28 @@ public:
     void readThemes(const QString& path);
     void readBundles(const QString& path);
 
-    QMap<QString, QVariantMap> getSyntaxData() const;
+    /**
+      * Returns the compiled grammars of the bundles read, shared by all
+      * highlighters
+      */
+    Grammar grammar() const;
+
+    /**
+      * Returns the preferences of the bundles read, like indent patterns
+      * and comment markers, by scope
+      */
+    Preferences preferences() const;
+
+    /**
+      * Returns the scope names of the grammars read
+      */
+    QStringList scopeNames() const;
+
+    /**
+      * Returns the scope name of the grammar for files with the extension,
+      * or a null string if there is none
+      */
+    QString scopeNameForExtension(const QString& extension) const;
 
     Highlighter* getHighlighterForExtension(const QString& extension, QTextDocument* document);
 
@@ -3,13 +3,35 @@
 
 #include <QAction>
 #include <QFile>
+#include <QScrollBar>
 #include <QTextBlock>
+#include <QTimer>
 #include <QKeyEvent>
 #include <QToolTip>
 
 #include <QtDebug>
 
-EditorBlockData::EditorBlockData()
+namespace {
+
+// Blocks off screen given the formats of a new theme at a time, between
+// handling other events
+const int FormatBlocksPerUpdate = 200;
+
+const int IndentWidth = 4;
+
+// Shell variables of bundle preferences with line comment markers
+const char* const CommentStartVariables[] = { "TM_COMMENT_START", "TM_COMMENT_START_2", "TM_COMMENT_START_3" };
+
+bool _Matches(const Regex& regex, const QString& text)
+{
+    Match match;
+    return regex.isValid() && regex.search(text, match);
+}
+
+}
+
+EditorBlockData::EditorBlockData() :
+    themeGeneration(-1)
 {
 }
 
@@ -74,20 +96,35 @@ Editor::Editor(QWidget *parent) :
         addAction(action);
     }
     connect(this, SIGNAL(cursorPositionChanged()), this, SLOT(highlightMatching()));
+
+    formatTimer = new QTimer(this);
+    formatTimer->setSingleShot(true);
+    connect(formatTimer, SIGNAL(timeout()), this, SLOT(updateMoreFormats()));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateFormats()));
+}
+
+void Editor::setPreferences(const Preferences& preferences)
+{
+    this->preferences = preferences;
 }
 
 QString Editor::scopeForCursor(const QTextCursor& cursor) const
+{
+    return ScopeAtoms::names(scopeStackForCursor(cursor)).join("\n");
+}
+
+ScopeStack Editor::scopeStackForCursor(const QTextCursor& cursor) const
 {
     QTextBlock block = cursor.block();
     if (!block.isValid())
-        return QString();
+        return ScopeStack();
 
     EditorBlockData *blockData = EditorBlockData::forBlock(cursor.block());
-    QMap<QTextCursor, QStringList>::const_iterator it = blockData->scopes.lowerBound(cursor);
+    QMap<QTextCursor, ScopeStack>::const_iterator it = blockData->scopes.lowerBound(cursor);
     if (it != blockData->scopes.end() && it.key().anchor() <= cursor.position()) {
-        return it.value().join("\n");
+        return it.value();
     }
-    return QString();
+    return ScopeStack();
 }
 
 bool Editor::currentIndent(const QTextCursor& cursor, int* indent) const
@@ -133,9 +170,23 @@ void Editor::doIndent(QTextCursor cursor)
         cursor.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, indent);
         cursor.removeSelectedText();
     }
+    // The line's own scope decides if it's unindented, empty lines have none
+    const ScopeStack lineScope = scopeStackForCursor(cursor);
     QTextCursor previous = cursor;
     while (previous.movePosition(QTextCursor::PreviousBlock)) {
+        // The preferences for the scope at the end of the line above
+        QTextCursor lineEnd = previous;
+        lineEnd.movePosition(QTextCursor::EndOfBlock);
+        const ScopePreferences lineAbove = preferences.find(scopeStackForCursor(lineEnd));
+        const QString text = previous.block().text();
+        if (_Matches(lineAbove.unIndentedLinePattern, text))
+            continue;
         if (currentIndent(previous, &indent)) {
+            if (_Matches(lineAbove.increaseIndentPattern, text))
+                indent += IndentWidth;
+            const ScopePreferences line = lineScope.isEmpty() ? lineAbove : preferences.find(lineScope);
+            if (_Matches(line.decreaseIndentPattern, cursor.block().text()))
+                indent = qMax(0, indent - IndentWidth);
             cursor.insertText(QString(" ").repeated(indent));
             break;
         }
@@ -319,9 +370,37 @@ void Editor::newline()
 void Editor::smartNewline()
 {
     QTextCursor cursor = textCursor();
-    QRegExp exp("^(\\W*)((?=\\w)|$)");
-    exp.indexIn(cursor.block().text());
-    QString prefix = exp.cap().left(cursor.positionInBlock());
+    const QString text = cursor.block().text();
+    const ScopePreferences scopePreferences = preferences.find(scopeStackForCursor(cursor));
+
+    // Continue a line comment, with the markers of the bundle for the
+    // scope, or else anything before the first word
+    QStringList markers;
+    for (uint i = 0; i < sizeof(CommentStartVariables) / sizeof(CommentStartVariables[0]); i++) {
+        QString marker = scopePreferences.shellVariables.value(CommentStartVariables[i]).trimmed();
+        if (!marker.isEmpty())
+            markers << marker;
+    }
+    QString prefix;
+    if (!markers.isEmpty()) {
+        int indent = 0;
+        currentIndent(cursor, &indent);
+        foreach (const QString& marker, markers) {
+            if (text.midRef(indent, marker.size()) == marker) {
+                int end = indent + marker.size();
+                while (end < text.size() && text.at(end).isSpace())
+                    end++;
+                prefix = text.left(end);
+                break;
+            }
+        }
+    }
+    if (prefix.isNull()) {
+        QRegExp exp("^(\\W*)((?=\\w)|$)");
+        exp.indexIn(text);
+        prefix = exp.cap();
+    }
+    prefix = prefix.left(cursor.positionInBlock());
 
     cursor.beginEditBlock();
     cursor.insertBlock();
@@ -464,3 +543,22 @@ bool Editor::event(QEvent *e)
         return QTextEdit::event(e);
     }
 }
+
+void Editor::updateFormats()
+{
+    Highlighter* highlighter = document()->findChild<Highlighter*>();
+    if (!highlighter)
+        return;
+
+    QTextBlock first = cursorForPosition(QPoint(0, 0)).block();
+    QTextBlock last = cursorForPosition(QPoint(viewport()->width(), viewport()->height())).block();
+    highlighter->updateFormats(first, last);
+    formatTimer->start();
+}
+
+void Editor::updateMoreFormats()
+{
+    Highlighter* highlighter = document()->findChild<Highlighter*>();
+    if (highlighter && highlighter->updateMoreFormats(FormatBlocksPerUpdate))
+        formatTimer->start();
+}
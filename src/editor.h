@@ -4,6 +4,10 @@
 #include <QTextEdit>
 #include <QtGui/QTextBlockUserData>
 
+#include "preferences.h"
+#include "scopeatoms.h"
+
+class QTimer;
 class HighlighterContext;
 class EditorBlockData : public QTextBlockUserData
 {
@@ -13,7 +17,11 @@ public:
 
     static EditorBlockData* forBlock(QTextBlock block);
 
-    QMap<QTextCursor, QStringList> scopes;
+    QMap<QTextCursor, ScopeStack> scopes;
+
+    // The theme of the highlighter the formats are from, or -1 if the
+    // block hasn't been highlighted
+    int themeGeneration;
 
     QScopedPointer<HighlighterContext> context;
 };
@@ -26,7 +34,13 @@ public:
 
     explicit Editor(QWidget *parent = 0);
 
+    /**
+      * Set the bundle preferences used for indenting and comments
+      */
+    void setPreferences(const Preferences& preferences);
+
     QString scopeForCursor(const QTextCursor& cursor) const;
+    ScopeStack scopeStackForCursor(const QTextCursor& cursor) const;
 
     bool currentIndent(const QTextCursor& cursor, int* indent) const;
     bool isLeadingWhitespace(const QTextCursor& cursor) const;
@@ -74,11 +88,23 @@ public slots:
 
     void highlightMatching();
 
+    /**
+      * Gives the visible blocks the formats of the current theme, if they
+      * were highlighted with another one, and then the rest of the document
+      * a few blocks at a time
+      */
+    void updateFormats();
+
 protected:
     void keyPressEvent(QKeyEvent* e);
     bool event(QEvent *e);
 
+private slots:
+    void updateMoreFormats();
+
 private:
+    QTimer* formatTimer;
+    Preferences preferences;
 };
 
 #endif // EDITOR_H
@@ -1,11 +1,62 @@
 #include "grammar.h"
+#include "bundlecache.h"
+#include "plistreader.h"
 #include "ruledata.h"
+#include "syntaxdata.h"
+
+#include <QtCore/QBitArray>
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QWeakPointer>
 
 #include <QtDebug>
 
+namespace {
+const int MaxCachedEndPatterns = 256;
+const int MaxCachedRegexes = 1024;
+const int MaxCachedSyntaxData = 32;
+
+/**
+  * True if Match::format() would substitute anything in the pattern
+  */
+bool hasBackReferences(const QString& pattern)
+{
+    for (int i = 0; i < 10; i++) {
+        if (pattern.contains("\\" + QString::number(i)))
+            return true;
+    }
+    return false;
+}
+}
+
 class GrammarPrivate
 {
     friend class Grammar;
+
+    GrammarPrivate() : syntaxData(MaxCachedSyntaxData), regexes(MaxCachedRegexes),
+        endPatterns(MaxCachedEndPatterns), regexesCompiled(0) {}
+
+    QMutex mutex;
+    QMap<QString, BundleFile> syntaxFiles;
+
+    // Rule tables in use, dropped with the last highlighter using them
+    QMap<QString, QWeakPointer<GrammarData> > grammars;
+
+    // Grammars read from syntaxFiles, only needed while compiling
+    QCache<QString, SyntaxData> syntaxData;
+
+    // Compiled patterns, shared by all rule tables. Tables keep copies of
+    // the regexes they use, so a pattern dropped from here is freed once no
+    // table uses it.
+    QCache<QString, Regex> regexes;
+
+    // Formatted end patterns are determined by the captured values, so the
+    // formatted pattern itself is used as key
+    QCache<QString, Regex> endPatterns;
+
+    int regexesCompiled;
 };
 
 Grammar::Grammar()
@@ -17,133 +68,372 @@ Grammar::~Grammar()
 {
 }
 
-RulePtr Grammar::compile(const QMap<QString, QVariantMap>& syntaxData, const QString& scopeName)
+void Grammar::setSyntaxFiles(const QMap<QString, BundleFile>& syntaxFiles)
 {
-    RulePtr root = readSyntaxData(syntaxData[scopeName]);
-    QMap<QString, RulePtr> repository = readRepository(syntaxData[scopeName]);
-    resolveChildRules(syntaxData, repository, root, root, root);
-    return root;
+    QMutexLocker locker(&d->mutex);
+    d->syntaxFiles = syntaxFiles;
+    d->syntaxData.clear();
+    d->grammars.clear();
 }
 
-RulePtr Grammar::readSyntaxData(const QVariantMap& syntaxData) const
+GrammarDataPtr Grammar::compile(const QString& scopeName) const
 {
-    QVariantMap rootData;
-    rootData["patterns"] = syntaxData.value("patterns");
-    return makeRule(rootData);
+    {
+        QMutexLocker locker(&d->mutex);
+        if (GrammarDataPtr data = d->grammars.value(scopeName).toStrongRef())
+            return data;
+        if (!d->syntaxFiles.contains(scopeName))
+            return GrammarDataPtr();
+    }
+
+    GrammarDataPtr data(new GrammarData);
+    data->root = readSyntaxData(*data, scopeName);
+    if (data->root == NoRule)
+        return GrammarDataPtr();
+
+    // Another thread may have compiled it meanwhile
+    QMutexLocker locker(&d->mutex);
+    if (GrammarDataPtr other = d->grammars.value(scopeName).toStrongRef())
+        return other;
+    d->grammars.insert(scopeName, data);
+    return data;
 }
 
-QMap<QString, RulePtr> Grammar::readRepository(const QVariantMap& syntaxData) const
+int Grammar::regexCount() const
 {
-    QMap<QString, RulePtr> repository;
-    QVariantMap repositoryData = syntaxData.value("repository").toMap();
-    QMapIterator<QString, QVariant> iter(repositoryData);
-    while (iter.hasNext()) {
-        iter.next();
-        QVariantMap ruleData = iter.value().toMap();
-        repository["#" + iter.key()] = makeRule(ruleData);
+    QMutexLocker locker(&d->mutex);
+    return d->regexesCompiled;
+}
+
+void Grammar::resolveChildRules(GrammarData& data, RuleId context) const
+{
+    if (data.rules.at(context).hasSearchSet)
+        return;
+
+    QVector<RuleId> rules;
+    QBitArray seen(data.rules.size());
+    QBitArray expanded(data.rules.size());
+    expanded.setBit(context);
+    collectSearchRules(data, context, rules, seen, expanded);
+
+    QList<Regex> regexes;
+    foreach (RuleId id, rules) {
+        const RuleData& rule = data.rules.at(id);
+        regexes << (rule.begin.isValid() ? rule.begin : rule.match);
     }
-    return repository;
+
+    RuleData& rule = data.rules[context];
+    rule.searchRules.start = data.searchRules.size();
+    rule.searchRules.count = rules.size();
+    data.searchRules += rules;
+    rule.searchSet = RegexSet(regexes);
+    rule.hasSearchSet = true;
 }
 
-QMap<int, RulePtr> Grammar::makeCaptures(const QVariantMap& capturesData) const
+/**
+  * Duplicates are dropped, they could never win over their first occurrence
+  */
+void Grammar::collectSearchRules(GrammarData& data, RuleId parentRule, QVector<RuleId>& rules,
+                                 QBitArray& seen, QBitArray& expanded) const
 {
-    QMap<int, RulePtr> captures;
-    QMapIterator<QString, QVariant> iter(capturesData);
+    resolveIncludes(data, parentRule);
+
+    const RuleSpan patterns = data.rules.at(parentRule).patterns;
+    for (int i = 0; i < patterns.count; i++) {
+        RuleId id = data.children.at(patterns.start + i);
+        if (data.rules.at(id).include != NoRule)
+            id = data.rules.at(id).include;
+
+        // Rules made while collecting are added to the end of the table
+        if (seen.size() < data.rules.size()) {
+            seen.resize(data.rules.size());
+            expanded.resize(data.rules.size());
+        }
+
+        compileRule(data, id);
+        const RuleData& rule = data.rules.at(id);
+        if (rule.begin.isValid() || rule.match.isValid()) {
+            if (!seen.testBit(id)) {
+                seen.setBit(id);
+                rules << id;
+            }
+        } else if (!expanded.testBit(id)) {
+            expanded.setBit(id);
+            collectSearchRules(data, id, rules, seen, expanded);
+        }
+    }
+}
+
+/**
+  * Resolves the includes among the child rules of parentRule, once
+  */
+void Grammar::resolveIncludes(GrammarData& data, RuleId parentRule) const
+{
+    if (data.rules.at(parentRule).resolved)
+        return;
+
+    // The table grows while included rules are made, so look up by index
+    const RuleSpan patterns = data.rules.at(parentRule).patterns;
+    for (int i = 0; i < patterns.count; i++) {
+        RuleId rule = data.children.at(patterns.start + i);
+        if (data.includes.contains(rule)) {
+            RuleId include = resolveIncludeChain(data, rule);
+            data.rules[rule].include = include;
+        }
+    }
+    data.rules[parentRule].resolved = true;
+}
+
+/**
+  * Returns the rule at the end of a chain of include rules, like a
+  * repository rule that only includes another one. A cycle ends at the
+  * first rule that is seen again.
+  */
+RuleId Grammar::resolveIncludeChain(GrammarData& data, RuleId rule) const
+{
+    QSet<RuleId> visited;
+    visited.insert(rule);
+    RuleId target = resolveInclude(data, rule);
+    while (target != NoRule && !visited.contains(target)) {
+        visited.insert(target);
+        if (data.includes.contains(target)) {
+            RuleId include = resolveInclude(data, target);
+            data.rules[target].include = include;
+        }
+        if (data.rules.at(target).include == NoRule)
+            break;
+        target = data.rules.at(target).include;
+    }
+    return target;
+}
+
+void Grammar::compileRule(GrammarData& data, RuleId id) const
+{
+    RuleData& rule = data.rules[id];
+    if (rule.compiled)
+        return;
+
+    if (!rule.beginPattern.isNull()) {
+        rule.begin = makeRegex(rule.beginPattern);
+        data.regexCount++;
+    }
+    if (!rule.endPattern.isNull() && !rule.endHasBackReferences) {
+        rule.end = makeRegex(rule.endPattern);
+        data.regexCount++;
+    }
+    if (!rule.matchPattern.isNull()) {
+        rule.match = makeRegex(rule.matchPattern);
+        data.regexCount++;
+    }
+    rule.compiled = true;
+}
+
+Regex Grammar::endRegex(const RuleData& rule, const Match& beginMatch) const
+{
+    if (!rule.endHasBackReferences)
+        return rule.end;
+
+    QString pattern = beginMatch.format(rule.endPattern);
+    {
+        QMutexLocker locker(&d->mutex);
+        if (Regex* cached = d->endPatterns.object(pattern))
+            return *cached;
+    }
+
+    Regex regex(pattern);
+    QMutexLocker locker(&d->mutex);
+    d->endPatterns.insert(pattern, new Regex(regex));
+    return regex;
+}
+
+/**
+  * Returns the compiled pattern, compiling it the first time
+  */
+Regex Grammar::makeRegex(const QString& pattern) const
+{
+    {
+        QMutexLocker locker(&d->mutex);
+        if (Regex* cached = d->regexes.object(pattern))
+            return *cached;
+    }
+
+    // Compiled without the lock, other threads may look up other patterns
+    Regex regex(pattern);
+    QMutexLocker locker(&d->mutex);
+    if (Regex* cached = d->regexes.object(pattern))
+        return *cached;
+    d->regexes.insert(pattern, new Regex(regex));
+    d->regexesCompiled++;
+    return regex;
+}
+
+RuleId Grammar::readSyntaxData(GrammarData& data, const QString& scopeName) const
+{
+    SyntaxData syntaxData;
+    BundleFile file;
+    {
+        QMutexLocker locker(&d->mutex);
+        if (SyntaxData* cached = d->syntaxData.object(scopeName))
+            syntaxData = *cached;
+        else if (d->syntaxFiles.contains(scopeName))
+            file = d->syntaxFiles.value(scopeName);
+        else
+            return NoRule;
+    }
+
+    // Read without the lock, other threads may compile other grammars
+    if (file.cache) {
+        QScopedPointer<PlistStream> stream(file.read());
+        syntaxData = SyntaxData::read(*stream);
+        QMutexLocker locker(&d->mutex);
+        d->syntaxData.insert(scopeName, new SyntaxData(syntaxData));
+    }
+
+    // The root rule is named after the grammar, the highlighter puts it at
+    // the bottom of the scope stack
+    SyntaxRule rootData;
+    rootData.name = scopeName;
+    rootData.patterns = syntaxData.patterns;
+    RuleId root = makeRule(data, NoRule, rootData);
+    data.grammars[scopeName] = root;
+    data.repositoryData[root] = syntaxData.repository;
+    return root;
+}
+
+RuleId Grammar::findRepositoryRule(GrammarData& data, RuleId selfRule, const QString& name) const
+{
+    const QMap<QString, RuleId> repository = data.repositories.value(selfRule);
+    if (repository.contains(name))
+        return repository.value(name);
+
+    // Each entry is made once, so it's dropped from the data once made,
+    // and the data with it when all entries are made
+    QHash<RuleId, QMap<QString, SyntaxRule> >::iterator repositoryData = data.repositoryData.find(selfRule);
+    if (repositoryData == data.repositoryData.end() || !repositoryData->contains(name))
+        return NoRule;
+    const SyntaxRule ruleData = repositoryData->take(name);
+    if (repositoryData->isEmpty())
+        data.repositoryData.erase(repositoryData);
+    RuleId rule = makeRule(data, selfRule, ruleData);
+    data.repositories[selfRule][name] = rule;
+    return rule;
+}
+
+RuleSpan Grammar::makeCaptures(GrammarData& data, RuleId selfRule, const QMap<int, SyntaxRule>& capturesData) const
+{
+    QMap<int, RuleId> rules;
+    QMapIterator<int, SyntaxRule> iter(capturesData);
     while (iter.hasNext()) {
         iter.next();
-        int num = iter.key().toInt();
-        QVariantMap data = iter.value().toMap();
-        captures[num] = makeRule(data);
+        rules[iter.key()] = makeRule(data, selfRule, iter.value());
+    }
+
+    // A dense table, indexed by group number
+    RuleSpan captures;
+    if (rules.isEmpty())
+        return captures;
+    QVector<RuleId>& captureRules = data.captureRules;
+    captures.start = captureRules.size();
+    captures.count = rules.lastKey() + 1;
+    captureRules.resize(captures.start + captures.count);
+    for (int i = captures.start; i < captureRules.size(); i++)
+        captureRules[i] = NoRule;
+    QMapIterator<int, RuleId> rule(rules);
+    while (rule.hasNext()) {
+        rule.next();
+        captureRules[captures.start + rule.key()] = rule.value();
     }
     return captures;
 }
 
-RulePtr Grammar::makeRule(const QVariantMap& ruleData) const
+/**
+  * Makes a rule and its child rules. selfRule is the root of the grammar
+  * they are in, or NoRule when making the root.
+  */
+RuleId Grammar::makeRule(GrammarData& data, RuleId selfRule, const SyntaxRule& ruleData) const
 {
-    RulePtr rule(new RuleData);
+    // Child rules are added to the table while this one is made
+    const RuleId id = data.rules.size();
+    data.rules.append(RuleData());
+    if (selfRule == NoRule)
+        selfRule = id;
 
-    rule->name = ruleData.value("name").toString();
-    if (ruleData.contains("contentName"))
-        rule->contentName = ruleData.value("contentName").toString();
+    RuleData rule;
+    rule.name = ScopeAtoms::intern(ruleData.name);
+    if (!ruleData.contentName.isNull())
+        rule.contentName = ScopeAtoms::intern(ruleData.contentName);
     else
-        rule->contentName = rule->name;
-    rule->includeName = ruleData.value("include").toString();
-    if (ruleData.contains("begin")) {
-        rule->beginPattern = ruleData.value("begin").toString();
-        rule->begin.setPattern(rule->beginPattern);
+        rule.contentName = rule.name;
+    if (!ruleData.include.isEmpty()) {
+        GrammarData::Include include;
+        include.name = ruleData.include;
+        include.self = selfRule;
+        data.includes.insert(id, include);
     }
-    if (ruleData.contains("end")) {
-        rule->endPattern = ruleData.value("end").toString();
-    }
-    if (ruleData.contains("match")) {
-        rule->matchPattern = ruleData.value("match").toString();
-        rule->match.setPattern(rule->matchPattern);
-    }
-    QVariant ruleListData = ruleData.value("patterns");
-    if (ruleListData.isValid()) {
-        rule->patterns = makeRuleList(ruleListData.toList());
+    rule.beginPattern = ruleData.begin;
+    if (!ruleData.end.isNull()) {
+        rule.endPattern = ruleData.end;
+        rule.endHasBackReferences = hasBackReferences(rule.endPattern);
+    } else if (!ruleData.begin.isNull()) {
+        // Without an end, the empty pattern ends the context right after
+        // it begins, as it always has
+        rule.endPattern = QString("");
     }
+    rule.matchPattern = ruleData.match;
+    rule.patterns = makeRuleList(data, selfRule, ruleData.patterns);
 
-    QVariant capturesData = ruleData.value("captures");
-    rule->captures = makeCaptures(capturesData.toMap());
-    QVariant beginCapturesData = ruleData.value("beginCaptures");
-    if (beginCapturesData.isValid())
-        rule->beginCaptures = makeCaptures(beginCapturesData.toMap());
+    rule.captures = makeCaptures(data, selfRule, ruleData.captures);
+    if (ruleData.hasBeginCaptures)
+        rule.beginCaptures = makeCaptures(data, selfRule, ruleData.beginCaptures);
     else
-        rule->beginCaptures = rule->captures;
-    QVariant endCapturesData = ruleData.value("endCaptures");
-    if (endCapturesData.isValid())
-        rule->endCaptures = makeCaptures(endCapturesData.toMap());
+        rule.beginCaptures = rule.captures;
+    if (ruleData.hasEndCaptures)
+        rule.endCaptures = makeCaptures(data, selfRule, ruleData.endCaptures);
     else
-        rule->endCaptures = rule->captures;
+        rule.endCaptures = rule.captures;
 
-    return rule;
+    data.rules[id] = rule;
+    return id;
 }
 
-QList<RulePtr> Grammar::makeRuleList(const QVariantList& ruleListData) const
+RuleSpan Grammar::makeRuleList(GrammarData& data, RuleId selfRule, const QList<SyntaxRule>& ruleListData) const
 {
-    QList<RulePtr> rules;
-    QListIterator<QVariant> iter(ruleListData);
-    while (iter.hasNext()) {
-        QVariantMap ruleData = iter.next().toMap();
-        rules << makeRule(ruleData);
-    }
-    return rules;
+    QVector<RuleId> rules;
+    foreach (const SyntaxRule& ruleData, ruleListData)
+        rules << makeRule(data, selfRule, ruleData);
+
+    // Added after the children's own lists, to keep this one contiguous
+    RuleSpan patterns;
+    patterns.start = data.children.size();
+    patterns.count = rules.size();
+    data.children += rules;
+    return patterns;
 }
 
-void Grammar::resolveChildRules(const QMap<QString, QVariantMap>& syntaxData,
-                                const QMap<QString, RulePtr>& repository,
-                                RulePtr baseRule, RulePtr selfRule, RulePtr parentRule) const
+/**
+  * Returns the rule that an include rule refers to directly, making it if
+  * needed
+  */
+RuleId Grammar::resolveInclude(GrammarData& data, RuleId rule) const
 {
-    QListIterator<RulePtr> iter(parentRule->patterns);
-    while (iter.hasNext()) {
-        RulePtr rule = iter.next();
-        if (rule->includeName != QString()) {
-            if (rule->includeName == "$base") {
-                rule->include = baseRule;
-            } else if (rule->includeName == "$self") {
-                rule->include = selfRule;
-            } else if (selfRule->referenced.contains(rule->includeName)) {
-                rule->include = selfRule->referenced[rule->includeName];
-            } else if (repository.contains(rule->includeName)) {
-                RulePtr rRule = repository.value(rule->includeName);
-                selfRule->referenced[rule->includeName] = rRule;
-                resolveChildRules(syntaxData, repository, baseRule, selfRule, rRule);
-                rule->include = rRule;
-            } else if (baseRule->referenced.contains(rule->includeName)) {
-                rule->include = baseRule->referenced[rule->includeName];
-            } else if (syntaxData.contains(rule->includeName)) {
-                QVariantMap data = syntaxData[rule->includeName];
-                RulePtr iRule = readSyntaxData(data);
-                baseRule->referenced[rule->includeName] = iRule;
-                QMap<QString, RulePtr> iRepo = readRepository(data);
-                resolveChildRules(syntaxData, iRepo, baseRule, iRule, iRule);
-                rule->include = iRule;
-            } else {
-                qWarning() << "Pattern not in repository" << rule->includeName;
-            }
-        } else {
-            resolveChildRules(syntaxData, repository, baseRule, selfRule, rule);
-        }
+    const GrammarData::Include include = data.includes.take(rule);
+    if (include.name == "$base")
+        return data.root;
+    if (include.name == "$self")
+        return include.self;
+
+    if (include.name.startsWith('#')) {
+        RuleId rRule = findRepositoryRule(data, include.self, include.name.mid(1));
+        if (rRule != NoRule)
+            return rRule;
+    } else if (data.grammars.contains(include.name)) {
+        return data.grammars.value(include.name);
+    } else {
+        RuleId iRule = readSyntaxData(data, include.name);
+        if (iRule != NoRule)
+            return iRule;
     }
+
+    qWarning() << "Pattern not in repository" << include.name;
+    return NoRule;
 }
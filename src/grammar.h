@@ -3,34 +3,103 @@
 
 #include <QtCore/QString>
 #include <QtCore/QMap>
-#include <QtCore/QVariant>
 #include <QtCore/QSharedPointer>
-#include <QtCore/QWeakPointer>
+#include <QtCore/QVector>
 
 class GrammarPrivate;
+class QBitArray;
+class Match;
+class Regex;
 
 struct RuleData;
-typedef QSharedPointer<RuleData> RulePtr;
-typedef QWeakPointer<RuleData> WeakRulePtr;
+struct RuleSpan;
+struct GrammarData;
+struct BundleFile;
+struct SyntaxRule;
+typedef QSharedPointer<GrammarData> GrammarDataPtr;
 
+/**
+  * Index of a rule in GrammarData::rules
+  */
+typedef qint32 RuleId;
+const RuleId NoRule = -1;
+
+/**
+  * The compiled grammars, by scope name.
+  *
+  * Copies share the same grammars, so all highlighters compile each grammar
+  * only once. All functions are thread safe, but resolveChildRules() and
+  * compileRule() change the rule table, and must be called with its lock
+  * held for writing.
+  */
 class Grammar
 {
 public:
     Grammar();
     ~Grammar();
 
-    RulePtr compile(const QMap<QString, QVariantMap>& syntaxData, const QString& scopeName);
+    /**
+      * Set the grammar files, by scope name. Grammars compiled from the
+      * previous files are dropped, but stay valid while used.
+      *
+      * A file is read when its grammar is first compiled or included. The
+      * grammars read are kept in a bounded cache, for other grammars that
+      * include them.
+      */
+    void setSyntaxFiles(const QMap<QString, BundleFile>& syntaxFiles);
+
+    /**
+      * Returns the rule table for the grammar for scopeName, or a null
+      * pointer if there is no such grammar.
+      *
+      * The table is made on first use, with only the root rule. The rest is
+      * made as it's reached, by resolveChildRules(). It's shared while
+      * used, and dropped when the last pointer to it is.
+      */
+    GrammarDataPtr compile(const QString& scopeName) const;
+
+    /**
+      * Returns the number of regexes compiled for all rule tables so far.
+      * Tables share regexes with the same pattern, but a pattern no table
+      * used lately may be compiled again, and counts again.
+      */
+    int regexCount() const;
+
+    /**
+      * Builds the search rules of context on first use. These are the rules
+      * with a begin or match regex that are reachable from context, by
+      * following includes and rules that only contain patterns, in order
+      * and without duplicates. Their regexes are combined in a RegexSet.
+      *
+      * The rules reached are made and compiled here, including other
+      * grammars, and include chains are collapsed to point at their final
+      * rule.
+      */
+    void resolveChildRules(GrammarData& data, RuleId context) const;
+
+    /**
+      * Returns the regex that ends the context opened by rule, when its begin
+      * pattern produced beginMatch.
+      *
+      * End patterns without backreferences are compiled once, with the begin
+      * pattern. Patterns that refer to captures from the begin match
+      * are formatted and compiled here, and kept in a bounded cache.
+      */
+    Regex endRegex(const RuleData& rule, const Match& beginMatch) const;
 
 private:
-    RulePtr readSyntaxData(const QVariantMap &syntaxData) const;
-    QMap<QString, RulePtr> readRepository(const QVariantMap& syntaxData) const;
-    QMap<int, RulePtr> makeCaptures(const QVariantMap& capturesData) const;
-    RulePtr makeRule(const QVariantMap& ruleData) const;
-    QList<RulePtr> makeRuleList(const QVariantList& ruleListData) const;
-
-    void resolveChildRules(const QMap<QString, QVariantMap>& syntaxData,
-                           const QMap<QString, RulePtr>& repository,
-                           RulePtr baseRule, RulePtr selfRule, RulePtr parentRule) const;
+    Regex makeRegex(const QString& pattern) const;
+    RuleId readSyntaxData(GrammarData& data, const QString& scopeName) const;
+    RuleId findRepositoryRule(GrammarData& data, RuleId selfRule, const QString& name) const;
+    RuleSpan makeCaptures(GrammarData& data, RuleId selfRule, const QMap<int, SyntaxRule>& capturesData) const;
+    RuleId makeRule(GrammarData& data, RuleId selfRule, const SyntaxRule& ruleData) const;
+    RuleSpan makeRuleList(GrammarData& data, RuleId selfRule, const QList<SyntaxRule>& ruleListData) const;
+    void collectSearchRules(GrammarData& data, RuleId parentRule, QVector<RuleId>& rules,
+                            QBitArray& seen, QBitArray& expanded) const;
+    void resolveIncludes(GrammarData& data, RuleId parentRule) const;
+    RuleId resolveIncludeChain(GrammarData& data, RuleId rule) const;
+    RuleId resolveInclude(GrammarData& data, RuleId rule) const;
+    void compileRule(GrammarData& data, RuleId rule) const;
 
     QSharedPointer<GrammarPrivate> d;
 };
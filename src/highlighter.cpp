@@ -6,18 +6,23 @@
 #include "ruledata.h"
 #include "editor.h"
 
+#include <QTextBlock>
 #include <QTextCharFormat>
+#include <QTextDocument>
+#include <QTextLayout>
 #include <QList>
 #include <QStack>
 #include <QMap>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QReadWriteLock>
 
 #include <QtDebug>
 
 struct ContextItem {
-    explicit ContextItem(RulePtr p = RulePtr()) : rule(p) {}
+    explicit ContextItem(RuleId r = NoRule) : rule(r) {}
 
-    RulePtr rule;
-    QString formattedEndPattern;
+    RuleId rule;
     Regex end;
 };
 
@@ -25,6 +30,11 @@ namespace {
 typedef QString::const_iterator iter_t;
 enum MatchType { Normal, Begin, End };
 
+const int DefaultLineTimeBudget = 100;
+
+// Empty matches at the same position in a row, before giving up on them
+const int MaxEmptyMatches = 16;
+
 void _HashCombine(int& h, int hh) {
     h = (h << 4) ^ (h >> 28) ^ hh;
 }
@@ -43,7 +53,7 @@ int _Hash(const Regex& regex) {
 
 int _Hash(const ContextItem& item) {
     int h = 0;
-    _HashCombine(h, _Hash(item.rule->begin));
+    _HashCombine(h, item.rule);
     _HashCombine(h, _Hash(item.end));
     return h;
 }
@@ -55,6 +65,127 @@ int _Hash(const QStack<ContextItem>& stack) {
     }
     return h;
 }
+
+/**
+  * Build the search set of context if needed. That changes the rule table,
+  * so the read lock is traded for the write lock meanwhile.
+  */
+void _PrepareContext(const Grammar& grammar, GrammarData& data, RuleId context, QReadLocker& locker)
+{
+    if (data.rules.at(context).hasSearchSet)
+        return;
+
+    locker.unlock();
+    {
+        QWriteLocker writeLocker(&data.lock);
+        grammar.resolveChildRules(data, context);
+    }
+    locker.relock();
+}
+
+/**
+  * Remembers search results within one line, by regex identity.
+  *
+  * The leftmost match found from some offset is still the leftmost one when
+  * searching again from any later offset up to the match position, and a
+  * search that found nothing still finds nothing from later offsets.
+  */
+class SearchMemo
+{
+public:
+    explicit SearchMemo(MatchPool* pool) : pool(pool), count(0) {}
+    ~SearchMemo() { clear(); }
+
+    void clear();
+
+    /**
+      * Returns true if the result of searching from offset to range is known.
+      * In that case, index is set to the stored index, or -1 if there is no
+      * match, and the match is copied.
+      */
+    bool lookup(int key, int offset, int range, int* index, Match& match) const;
+
+    /**
+      * Remember the result of searching from offset to range. The match is
+      * ignored if index is -1.
+      */
+    void store(int key, int offset, int range, int index, const Match& match);
+
+private:
+    struct Entry {
+        int key;
+        int offset;
+        int range;
+        int index;
+        Match* match;
+    };
+
+    MatchPool* pool;
+    QVector<Entry> entries;
+    int count;
+};
+
+void SearchMemo::clear()
+{
+    for (int i = 0; i < count; i++) {
+        if (entries[i].match)
+            pool->release(entries[i].match);
+    }
+    count = 0;
+}
+
+bool SearchMemo::lookup(int key, int offset, int range, int* index, Match& match) const
+{
+    for (int i = 0; i < count; i++) {
+        const Entry& e = entries[i];
+        if (e.key != key)
+            continue;
+
+        if (e.offset > offset)
+            return false;
+        if (!e.match) {
+            *index = -1;
+            return range <= e.range;
+        }
+        if (e.match->pos() < offset)
+            return false;
+        if (e.match->pos() > range) {
+            *index = -1;
+            return true;
+        }
+        *index = e.index;
+        match.assign(*e.match);
+        return true;
+    }
+    return false;
+}
+
+void SearchMemo::store(int key, int offset, int range, int index, const Match& match)
+{
+    int i = 0;
+    while (i < count && entries[i].key != key)
+        i++;
+    if (i == count) {
+        if (count == entries.size())
+            entries.append(Entry());
+        entries[i].key = key;
+        entries[i].match = 0;
+        count++;
+    }
+
+    Entry& e = entries[i];
+    e.offset = offset;
+    e.range = range;
+    e.index = index;
+    if (index != -1) {
+        if (!e.match)
+            e.match = pool->acquire();
+        e.match->assign(match);
+    } else if (e.match) {
+        pool->release(e.match);
+        e.match = 0;
+    }
+}
 }
 
 HighlighterContext::~HighlighterContext()
@@ -65,19 +196,61 @@ class HighlighterPrivate
 {
     friend class Highlighter;
 
+    HighlighterPrivate() : memo(&matches), lineTimeBudget(DefaultLineTimeBudget),
+        themeGeneration(0), outdatedFrom(-1) {}
+
     BundleManager* bundleManager;
 
-    RulePtr root;
     Grammar grammar;
+    GrammarDataPtr rules;
+
+    MatchPool matches;
+    SearchMemo memo;
+    SearchTarget target;
+    int lineTimeBudget;
 
     Theme theme;
+
+    // Counts theme changes. Blocks highlighted with an earlier theme have
+    // outdated formats, and the ones from outdatedFrom on may be left,
+    // or it's -1.
+    int themeGeneration;
+    int outdatedFrom;
+
+    void updateFormats(QTextDocument* document, QTextBlock block);
 };
 
+/**
+  * Sets the formats of the current theme for the scopes stored when the
+  * block was highlighted, like QSyntaxHighlighter does after highlightBlock()
+  */
+void HighlighterPrivate::updateFormats(QTextDocument* document, QTextBlock block)
+{
+    EditorBlockData* blockData = static_cast<EditorBlockData*>(block.userData());
+    if (!blockData || blockData->themeGeneration == -1 || blockData->themeGeneration == themeGeneration)
+        return;
+    blockData->themeGeneration = themeGeneration;
+
+    QList<QTextLayout::FormatRange> ranges;
+    QMap<QTextCursor, ScopeStack>::const_iterator it;
+    for (it = blockData->scopes.constBegin(); it != blockData->scopes.constEnd(); ++it) {
+        QTextLayout::FormatRange range;
+        range.start = it.key().selectionStart() - block.position();
+        range.length = it.key().selectionEnd() - it.key().selectionStart();
+        range.format = theme.findFormat(it.value());
+        if (range.length > 0 && range.format != QTextCharFormat())
+            ranges << range;
+    }
+    block.layout()->setAdditionalFormats(ranges);
+    document->markContentsDirty(block.position(), block.length());
+}
+
 Highlighter::Highlighter(QTextDocument* document, BundleManager *bundleManager) :
     QSyntaxHighlighter(document),
     d(new HighlighterPrivate)
 {
     d->bundleManager = bundleManager;
+    d->grammar = d->bundleManager->grammar();
     d->theme = d->bundleManager->theme();
     connect(d->bundleManager, SIGNAL(themeChanged(Theme)), this, SLOT(setTheme(Theme)));
 }
@@ -86,79 +259,147 @@ Highlighter::~Highlighter()
 {
 }
 
+void Highlighter::setLineTimeBudget(int msecs)
+{
+    d->lineTimeBudget = msecs;
+}
+
+int Highlighter::lineTimeBudget() const
+{
+    return d->lineTimeBudget;
+}
+
 void Highlighter::setTheme(const Theme& theme)
 {
     if (d->theme != theme) {
         d->theme = theme;
-        rehighlight();
+        d->themeGeneration++;
+        d->outdatedFrom = 0;
+        emit formatsOutdated();
     }
 }
 
+void Highlighter::updateFormats(const QTextBlock& first, const QTextBlock& last)
+{
+    if (d->outdatedFrom == -1 || !first.isValid())
+        return;
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+        d->updateFormats(document(), block);
+        if (block == last)
+            break;
+    }
+}
+
+bool Highlighter::updateMoreFormats(int count)
+{
+    if (d->outdatedFrom == -1)
+        return false;
+    QTextBlock block = document()->findBlockByNumber(d->outdatedFrom);
+    for (int i = 0; i < count && block.isValid(); i++) {
+        d->updateFormats(document(), block);
+        block = block.next();
+    }
+    d->outdatedFrom = block.isValid() ? block.blockNumber() : -1;
+    return d->outdatedFrom != -1;
+}
+
 void Highlighter::readSyntaxData(const QString& scopeName)
 {
-    QMap<QString, QVariantMap> syntaxData = d->bundleManager->getSyntaxData();
-    d->root = d->grammar.compile(syntaxData, scopeName);
+    d->rules = d->grammar.compile(scopeName);
 }
 
 class Highlighter::SearchHelper
 {
 public:
-    SearchHelper(iter_t base, iter_t end, iter_t index);
-
+    SearchHelper(const Grammar& grammar, GrammarData& data, MatchPool& pool, SearchMemo& memo, const SearchTarget& target, iter_t index);
+    ~SearchHelper();
+
+    const Grammar& grammar;
+    GrammarData& data;
+    MatchPool& pool;
+    SearchMemo& memo;
+    const SearchTarget& target;
     const iter_t base;
     const iter_t end;
     const iter_t index;
     const int offset;
 
-    Match foundMatch;
+    Match& foundMatch;
     MatchType foundMatchType;
-    RulePtr foundRule;
+    RuleId foundRule;
 
-    void searchPattern(RulePtr rule, const Regex& regex, MatchType type);
-    void searchPatterns(RulePtr parentRule);
+    void searchPattern(RuleId rule, const Regex& regex, MatchType type);
+    void searchPatterns(RuleId parentRule);
     void searchContext(const ContextItem& context);
 
 private:
-    Match match;
+    Match& match;
 };
 
-Highlighter::SearchHelper::SearchHelper(iter_t base, iter_t end, iter_t index)
-    : base(base), end(end), index(index), offset(index - base)
+Highlighter::SearchHelper::SearchHelper(const Grammar& grammar, GrammarData& data, MatchPool& pool, SearchMemo& memo, const SearchTarget& target, iter_t index)
+    : grammar(grammar), data(data), pool(pool), memo(memo), target(target), base(target.begin()), end(target.end()),
+      index(index), offset(index - base),
+      foundMatch(*pool.acquire()), foundMatchType(Normal), foundRule(NoRule), match(*pool.acquire())
 {
 }
 
-void Highlighter::SearchHelper::searchPattern(RulePtr rule, const Regex& regex, MatchType type)
+Highlighter::SearchHelper::~SearchHelper()
 {
-    if (regex.isValid()) {
-        if (regex.search(base, end, index, end, match)) {
-            if (foundMatch.isEmpty() || match.pos() < foundMatch.pos()) {
-                foundRule = rule;
-                foundMatchType = type;
-                foundMatch.swap(match);
-            }
+    pool.release(&foundMatch);
+    pool.release(&match);
+}
+
+void Highlighter::SearchHelper::searchPattern(RuleId rule, const Regex& regex, MatchType type)
+{
+    if (!regex.isValid())
+        return;
+
+    int i = -1;
+    const int length = end - base;
+    const bool memoize = !regex.dependsOnSearchStart();
+    if (!memoize || !memo.lookup(regex.identity(), offset, length, &i, match)) {
+        i = regex.search(target, index, end, match) ? 0 : -1;
+        if (memoize)
+            memo.store(regex.identity(), offset, length, i, match);
+    }
+
+    if (i != -1) {
+        if (foundMatch.isEmpty() || match.pos() < foundMatch.pos()) {
+            foundRule = rule;
+            foundMatchType = type;
+            foundMatch.swap(match);
         }
     }
 }
 
-void Highlighter::SearchHelper::searchPatterns(RulePtr parentRule)
+void Highlighter::SearchHelper::searchPatterns(RuleId parentRule)
 {
-    foreach (RulePtr rule, parentRule->patterns) {
-        while (rule->include) {
-            rule = rule->include;
-        }
+    const RuleData& rule = data.rules.at(parentRule);
+    Q_ASSERT(rule.hasSearchSet);
+
+    // Only a match before the one already found can win
+    iter_t range = end;
+    if (!foundMatch.isEmpty()) {
+        Q_ASSERT(foundMatch.pos() >= offset);
+        if (foundMatch.pos() == offset)
+            return; // Don't need to continue
+        range = base + foundMatch.pos();
+    }
 
-        if (rule->begin.isValid()) {
-            searchPattern(rule, rule->begin, Begin);
-        } else if (rule->match.isValid()) {
-            searchPattern(rule, rule->match, Normal);
-        } else {
-            searchPatterns(rule);
-        }
+    int i = -1;
+    const RegexSet& set = rule.searchSet;
+    const bool memoize = !set.dependsOnSearchStart();
+    if (!memoize || !memo.lookup(set.identity(), offset, range - base, &i, match)) {
+        i = set.search(target, index, range, match);
+        if (memoize)
+            memo.store(set.identity(), offset, range - base, i, match);
+    }
 
-        if (!foundMatch.isEmpty()) {
-            Q_ASSERT(foundMatch.pos() >= offset);
-            if (foundMatch.pos() == offset)
-                break; // Don't need to continue
+    if (i != -1) {
+        if (foundMatch.isEmpty() || match.pos() < foundMatch.pos()) {
+            foundRule = data.searchRules.at(rule.searchRules.start + i);
+            foundMatchType = data.rules.at(foundRule).begin.isValid() ? Begin : Normal;
+            foundMatch.swap(match);
         }
     }
 }
@@ -171,41 +412,84 @@ void Highlighter::SearchHelper::searchContext(const ContextItem& context)
 
 void Highlighter::highlightBlock(const QString &text)
 {
-    if (!d->root)
+    if (!d->rules)
         return;
+    GrammarData& data = *d->rules;
+
+    // Other highlighters may be making rules in the same table
+    QReadLocker locker(&data.lock);
+
+    // Search results are only valid within one line
+    d->memo.clear();
+    d->target.setText(text.begin(), text.end());
 
     QStack<ContextItem> contextStack;
-    QStack<QString> scope;
+    ScopeStack scope;
     EditorBlockData *prevBlockData = EditorBlockData::forBlock(currentBlock().previous());
-    if (prevBlockData && prevBlockData->context) {
+    if (prevBlockData && prevBlockData->context && prevBlockData->context->grammar == d->rules) {
         HighlighterContext* ctx = prevBlockData->context.data();
         contextStack = ctx->stack;
         scope = ctx->scope;
     } else {
-        contextStack.push(ContextItem(d->root));
+        contextStack.push(ContextItem(data.root));
+        scope.push(data.rules.at(data.root).name);
     }
 
     EditorBlockData *currentBlockData = EditorBlockData::forBlock(currentBlock());
     Q_ASSERT(currentBlockData != 0);
     currentBlockData->scopes.clear();
+    currentBlockData->themeGeneration = d->themeGeneration;
 
     const iter_t base = text.begin();
     const iter_t end = text.end();
 
+    QElapsedTimer timer;
+    timer.start();
+    int emptyMatches = 0;
+
     iter_t index = base;
     while (true) {
         Q_ASSERT(contextStack.size() > 0);
 
         // Find next pattern
-        SearchHelper s(base, end, index);
+        _PrepareContext(d->grammar, data, contextStack.top().rule, locker);
+        SearchHelper s(d->grammar, data, d->matches, d->memo, d->target, index);
         s.searchContext(contextStack.top());
 
+        // Give up on the rest of the line if it's too expensive
+        QString abortReason;
+        if (d->target.isAborted()) {
+            abortReason = "search limit exceeded";
+        } else if (d->lineTimeBudget > 0 && timer.elapsed() > d->lineTimeBudget) {
+            abortReason = "time budget exceeded";
+        }
+        if (!abortReason.isEmpty()) {
+            setScope(s.offset, text.length() - s.offset, scope);
+            emit highlightingAborted(currentBlock().blockNumber(), s.offset, abortReason);
+            break;
+        }
+
         // Did we find anything to highlight?
         if (s.foundMatch.isEmpty()) {
             setScope(s.offset, text.length() - s.offset, scope);
             break;
         }
 
+        // An empty match at index doesn't move on. Repeated ones would find
+        // the same matches forever, so step past one character instead.
+        if (s.foundMatch.len() == 0 && s.foundMatch.pos() == s.offset) {
+            if (++emptyMatches > MaxEmptyMatches) {
+                if (s.offset == text.length())
+                    break;
+                setScope(s.offset, 1, scope);
+                index++;
+                emptyMatches = 0;
+                continue;
+            }
+        } else {
+            emptyMatches = 0;
+        }
+
         // Highlight skipped section
         setScope(s.offset, s.foundMatch.pos() - s.offset, scope);
 
@@ -217,34 +501,36 @@ void Highlighter::highlightBlock(const QString &text)
 
         Q_ASSERT(base + s.foundMatch.pos() <= end);
 
-        QMap<int, RulePtr> captures;
+        const RuleData& foundRule = data.rules.at(s.foundRule);
+        RuleSpan captures;
         switch (s.foundMatchType) {
         case Normal:
-            captures = s.foundRule->captures;
+            captures = foundRule.captures;
             break;
         case Begin:
-            captures = s.foundRule->beginCaptures;
+            captures = foundRule.beginCaptures;
             break;
         case End:
-            captures = s.foundRule->endCaptures;
+            captures = foundRule.endCaptures;
             break;
         }
 
         // Highlight
-        scope.push(s.foundRule->name);
+        scope.push(foundRule.name);
         int pos = s.foundMatch.pos();
         int end = pos + s.foundMatch.len();
         for (int c = 1; c < s.foundMatch.size(); c++) {
             if (s.foundMatch.matched(c)) {
-                if (captures.contains(c)) {
+                RuleId captureRule = data.captureRule(captures, c);
+                if (captureRule != NoRule) {
                     Q_ASSERT(s.foundMatch.pos(c) >= s.foundMatch.pos());
                     Q_ASSERT(s.foundMatch.pos(c) + s.foundMatch.len(c) <= s.foundMatch.pos() + s.foundMatch.len());
 
                     int capPos = s.foundMatch.pos(c);
                     int capLen = s.foundMatch.len(c);
-                    setScope(pos, capPos, scope);
-                    scope.push(captures[c]->name);
-                    setScope(capPos, capPos + capLen, scope);
+                    setScope(pos, capPos - pos, scope);
+                    scope.push(data.rules.at(captureRule).name);
+                    setScope(capPos, capLen, scope);
                     scope.pop();
                     pos = capPos + capLen;
                 }
@@ -255,13 +541,12 @@ void Highlighter::highlightBlock(const QString &text)
 
         // Enter nested context
         if (s.foundMatchType == Begin) {
-            // Compile the regular expression that will end this context,
-            // and may include captures from the found match
+            // Look up the regular expression that will end this context,
+            // which may include captures from the found match
             ContextItem item(s.foundRule);
-            item.formattedEndPattern = s.foundMatch.format(s.foundRule->endPattern);
-            item.end.setPattern(item.formattedEndPattern);
+            item.end = d->grammar.endRegex(foundRule, s.foundMatch);
             contextStack.push(item);
-            scope.push(s.foundRule->contentName);
+            scope.push(foundRule.contentName);
         }
 
         index = base + s.foundMatch.pos() + s.foundMatch.len();
@@ -269,6 +554,7 @@ void Highlighter::highlightBlock(const QString &text)
 
     if (contextStack.size() > 1) {
         currentBlockData->context.reset(new HighlighterContext);
+        currentBlockData->context->grammar = d->rules;
         currentBlockData->context->stack = contextStack;
         currentBlockData->context->scope = scope;
         setCurrentBlockState(_Hash(contextStack));
@@ -278,9 +564,9 @@ void Highlighter::highlightBlock(const QString &text)
     }
 }
 
-void Highlighter::setScope(int start, int count, const QStack<QString>& scope)
+void Highlighter::setScope(int start, int count, const ScopeStack& scope)
 {
-    if (count == 0)
+    if (count <= 0)
         return;
 
     EditorBlockData *currentBlockData = EditorBlockData::forBlock(currentBlock());
@@ -288,7 +574,7 @@ void Highlighter::setScope(int start, int count, const QStack<QString>& scope)
     QTextCursor cursor(currentBlock());
     cursor.movePosition(QTextCursor::Right, QTextCursor::MoveAnchor, start);
     cursor.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, count);
-    currentBlockData->scopes[cursor] = QStringList(QStringList::fromVector(scope));
+    currentBlockData->scopes[cursor] = scope;
 
     setFormat(start, count, d->theme.findFormat(scope));
 }
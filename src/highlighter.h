@@ -5,6 +5,9 @@
 #include <QScopedPointer>
 #include <QtCore/QStack>
 
+#include "grammar.h"
+#include "scopeatoms.h"
+
 class Theme;
 class BundleManager;
 class HighlighterPrivate;
@@ -15,8 +18,10 @@ class HighlighterContext
 public:
     ~HighlighterContext();
 
+    // The rule table the stack refers to
+    GrammarDataPtr grammar;
     QStack<ContextItem> stack;
-    QStack<QString> scope;
+    ScopeStack scope;
 };
 
 class Highlighter : public QSyntaxHighlighter
@@ -26,6 +31,40 @@ public:
     explicit Highlighter(QTextDocument *document, BundleManager* bundleManager);
     ~Highlighter();
 
+    /**
+      * Set the maximum time spent on highlighting one line. If exceeded, the
+      * rest of the line gets the current scope. 0 means no limit.
+      */
+    void setLineTimeBudget(int msecs);
+    int lineTimeBudget() const;
+
+    /**
+      * Applies the current theme to the blocks from first to last that were
+      * highlighted with an earlier one, from the scopes stored for them,
+      * without highlighting them again
+      */
+    void updateFormats(const QTextBlock& first, const QTextBlock& last);
+
+    /**
+      * Applies the current theme to up to count more blocks of the
+      * document. Returns false when no blocks with outdated formats are left.
+      */
+    bool updateMoreFormats(int count);
+
+signals:
+    /**
+      * Emitted when highlighting of a line is given up at position, because
+      * it took too long, or because a search exceeded the regex search
+      * limits.
+      */
+    void highlightingAborted(int blockNumber, int position, const QString& reason);
+
+    /**
+      * Emitted when the theme is changed. The formats of the blocks are
+      * only updated by updateFormats() and updateMoreFormats().
+      */
+    void formatsOutdated();
+
 public slots:
     void setTheme(const Theme& theme);
     void readSyntaxData(const QString& scopeName);
@@ -34,7 +73,7 @@ protected:
     void highlightBlock(const QString &text);
 
 private:
-    void setScope(int start, int count, const QStack<QString>& scope);
+    void setScope(int start, int count, const ScopeStack& scope);
 
 private:
     QScopedPointer<HighlighterPrivate> d;
@@ -0,0 +1,131 @@
+#include "literalscanner.h"
+
+#include <QtCore/QQueue>
+
+LiteralScanner::LiteralScanner() :
+    ids(0), built(false)
+{
+    states.append(State());
+    for (int i = 0; i < 128; i++)
+        rootTable[i] = 0;
+}
+
+bool LiteralScanner::isEmpty() const
+{
+    return states.size() == 1;
+}
+
+int LiteralScanner::idCount() const
+{
+    return ids;
+}
+
+void LiteralScanner::addLiteral(const QString& literal, int id)
+{
+    Q_ASSERT(!built);
+    Q_ASSERT(!literal.isEmpty());
+
+    int state = 0;
+    foreach (QChar c, literal) {
+        int s = child(state, c.unicode());
+        if (s == -1) {
+            s = states.size();
+            states.append(State());
+
+            // Keep the edges sorted
+            QVector<QPair<ushort, int> >& edges = states[state].edges;
+            int i = edges.size();
+            while (i > 0 && edges[i - 1].first > c.unicode())
+                i--;
+            edges.insert(i, qMakePair(c.unicode(), s));
+        }
+        state = s;
+    }
+    states[state].outputs.append(qMakePair(id, literal.length()));
+    ids = qMax(ids, id + 1);
+}
+
+void LiteralScanner::build()
+{
+    Q_ASSERT(!built);
+
+    // Breadth first, so that failure links point to states already done
+    QQueue<int> queue;
+    for (int i = 0; i < states[0].edges.size(); i++) {
+        queue.enqueue(states[0].edges[i].second);
+    }
+    while (!queue.isEmpty()) {
+        int state = queue.dequeue();
+        for (int i = 0; i < states[state].edges.size(); i++) {
+            ushort c = states[state].edges[i].first;
+            int s = states[state].edges[i].second;
+
+            int f = states[state].fail;
+            while (f != 0 && child(f, c) == -1)
+                f = states[f].fail;
+            int target = child(f, c);
+            states[s].fail = (target == -1 || target == s) ? 0 : target;
+
+            // A state also reports everything its failure state reports
+            states[s].outputs += states[states[s].fail].outputs;
+            queue.enqueue(s);
+        }
+    }
+
+    for (int c = 0; c < 128; c++) {
+        int s = child(0, c);
+        rootTable[c] = (s == -1) ? 0 : s;
+    }
+    built = true;
+}
+
+void LiteralScanner::scan(const QChar* begin, const QChar* end, QVector<int>& lastStart) const
+{
+    Q_ASSERT(built);
+
+    lastStart.fill(-1, ids);
+    int state = 0;
+    for (const QChar* p = begin; p != end; ++p) {
+        state = next(state, p->unicode());
+
+        const QVector<QPair<int, int> >& outputs = states[state].outputs;
+        for (int i = 0; i < outputs.size(); i++) {
+            // Later occurrences start later, except for shorter strings
+            // ending at the same position
+            int start = (p - begin) + 1 - outputs[i].second;
+            if (start > lastStart[outputs[i].first])
+                lastStart[outputs[i].first] = start;
+        }
+    }
+}
+
+int LiteralScanner::child(int state, ushort c) const
+{
+    const QVector<QPair<ushort, int> >& edges = states[state].edges;
+    int low = 0;
+    int high = edges.size();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (edges[mid].first < c)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low < edges.size() && edges[low].first == c)
+        return edges[low].second;
+    return -1;
+}
+
+int LiteralScanner::next(int state, ushort c) const
+{
+    while (state != 0) {
+        int s = child(state, c);
+        if (s != -1)
+            return s;
+        state = states[state].fail;
+    }
+    if (c < 128)
+        return rootTable[c];
+    int s = child(0, c);
+    return (s == -1) ? 0 : s;
+}
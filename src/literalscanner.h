@@ -0,0 +1,63 @@
+#ifndef LITERALSCANNER_H
+#define LITERALSCANNER_H
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QPair>
+
+/**
+  * Finds many literal strings in a text in a single pass (Aho-Corasick).
+  *
+  * Each string is added with an id, several strings can share an id. After
+  * build(), the scanner is read only, and can be used by several threads.
+  */
+class LiteralScanner
+{
+public:
+    LiteralScanner();
+
+    /**
+      * Returns true if no strings were added
+      */
+    bool isEmpty() const;
+
+    /**
+      * Returns one more than the highest id added
+      */
+    int idCount() const;
+
+    /**
+      * Add a string to look for. Must be called before build().
+      */
+    void addLiteral(const QString& literal, int id);
+
+    /**
+      * Prepare for scanning
+      */
+    void build();
+
+    /**
+      * Scan the text, and store the position of the last occurrence of any
+      * string with id i in lastStart[i]. Ids without occurrences get -1.
+      */
+    void scan(const QChar* begin, const QChar* end, QVector<int>& lastStart) const;
+
+private:
+    struct State {
+        State() : fail(0) {}
+
+        QVector<QPair<ushort, int> > edges;     // Sorted by character
+        QVector<QPair<int, int> > outputs;      // Id and length
+        int fail;
+    };
+
+    int child(int state, ushort c) const;
+    int next(int state, ushort c) const;
+
+    QVector<State> states;
+    int rootTable[128];
+    int ids;
+    bool built;
+};
+
+#endif // LITERALSCANNER_H
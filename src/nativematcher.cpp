@@ -0,0 +1,471 @@
+#include "nativematcher.h"
+
+#include <QtCore/QStringList>
+#include <QtCore/QStringMatcher>
+#include <QtCore/QVector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+const int MaxSimdRanges = 4;
+
+bool isAsciiWordChar(ushort c)
+{
+    return c < 128 && regexIsWordChar(c);
+}
+
+/**
+  * Strip groups around node, counting the capturing ones
+  */
+RegexNodePtr unwrap(RegexNodePtr node, int* groups)
+{
+    while (node->type == RegexNode::Group) {
+        if (node->capture)
+            (*groups)++;
+        node = node->children[0];
+    }
+    return node;
+}
+
+/**
+  * Returns true if node only matches one string, without captures
+  */
+bool literalString(RegexNodePtr node, QString* literal)
+{
+    int groups = 0;
+    node = unwrap(node, &groups);
+    if (groups)
+        return false;
+
+    if (node->type == RegexNode::Char) {
+        if (node->caseInsensitive)
+            return false;
+        *literal = QChar(node->ch);
+        return true;
+    }
+    if (node->type != RegexNode::Concat)
+        return false;
+
+    literal->clear();
+    foreach (const RegexNodePtr& child, node->children) {
+        if (child->type != RegexNode::Char || child->caseInsensitive)
+            return false;
+        *literal += QChar(child->ch);
+    }
+    return true;
+}
+
+/**
+  * Word characters in the sense of \b. Surrogates are part of a character
+  * that may or may not be one, which is left to the regex engine.
+  */
+inline int wordAt(const QChar* p)
+{
+    ushort c = p->unicode();
+    if (c < 128)
+        return isAsciiWordChar(c);
+    if (c >= 0xd800 && c <= 0xdfff)
+        return -1;
+    return regexIsWordChar(c);
+}
+
+/**
+  * Exact string, like "//" or "\\("
+  */
+class LiteralMatcher : public NativeMatcher
+{
+public:
+    explicit LiteralMatcher(const QString& literal) :
+        literal(literal), matcher(literal)
+    {
+    }
+
+    const char* name() const { return "literal"; }
+
+    Result find(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                int* pos, int* len) const
+    {
+        // The match must start at range at the latest
+        int limit = qMin<int>(end - begin, (range - begin) + literal.length());
+        int i = matcher.indexIn(begin, limit, offset - begin);
+        if (i == -1)
+            return NotFound;
+
+        *pos = i;
+        *len = literal.length();
+        return Found;
+    }
+
+private:
+    QString literal;
+    QStringMatcher matcher;
+};
+
+/**
+  * Whole words from a list, like \b(if|else|while)\b. A word can only
+  * match if it's the complete run of word characters, so the order of the
+  * alternatives doesn't matter, and a hash lookup decides.
+  */
+class KeywordMatcher : public NativeMatcher
+{
+public:
+    explicit KeywordMatcher(const QStringList& words);
+
+    const char* name() const { return "keywords"; }
+
+    Result find(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                int* pos, int* len) const;
+
+private:
+    static uint hash(const QChar* s, int length, uint seed) {
+        uint h = 2166136261u ^ seed;
+        for (int i = 0; i < length; i++) {
+            h = (h ^ s[i].unicode()) * 16777619u;
+        }
+        return h;
+    }
+
+    bool contains(const QChar* s, int length) const;
+
+    QStringList words;
+    QVector<int> table;     // Index in words plus one, 0 for empty slots
+    uint seed;
+    uint mask;
+    int minLength;
+    int maxLength;
+};
+
+KeywordMatcher::KeywordMatcher(const QStringList& list) :
+    seed(0), minLength(-1), maxLength(0)
+{
+    foreach (const QString& word, list) {
+        if (!words.contains(word))
+            words << word;
+        if (minLength == -1 || word.length() < minLength)
+            minLength = word.length();
+        maxLength = qMax(maxLength, word.length());
+    }
+
+    // Find a seed without collisions, making the table larger when that
+    // takes too many tries
+    int size = 1;
+    while (size < words.size() * 2)
+        size *= 2;
+    for (;;) {
+        mask = size - 1;
+        for (seed = 0; seed < 256; seed++) {
+            table.fill(0, size);
+            bool collision = false;
+            for (int i = 0; i < words.size() && !collision; i++) {
+                uint slot = hash(words[i].constData(), words[i].length(), seed) & mask;
+                collision = (table[slot] != 0);
+                table[slot] = i + 1;
+            }
+            if (!collision)
+                return;
+        }
+        size *= 2;
+    }
+}
+
+bool KeywordMatcher::contains(const QChar* s, int length) const
+{
+    if (length < minLength || length > maxLength)
+        return false;
+
+    int i = table[hash(s, length, seed) & mask];
+    if (i == 0)
+        return false;
+
+    const QString& word = words[i - 1];
+    if (word.length() != length)
+        return false;
+    for (int j = 0; j < length; j++) {
+        if (word[j] != s[j])
+            return false;
+    }
+    return true;
+}
+
+NativeMatcher::Result KeywordMatcher::find(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                                             int* pos, int* len) const
+{
+    int prev = (offset > begin) ? wordAt(offset - 1) : 0;
+    if (prev == -1)
+        return Unknown;
+
+    const QChar* p = offset;
+    while (p < end && p <= range) {
+        int word = wordAt(p);
+        if (word == -1)
+            return Unknown;
+        if (!word || prev) {
+            prev = word;
+            p++;
+            continue;
+        }
+
+        // At the start of a word, find the end of it
+        const QChar* q = p + 1;
+        while (q < end) {
+            word = wordAt(q);
+            if (word == -1)
+                return Unknown;
+            if (!word)
+                break;
+            q++;
+        }
+
+        if (contains(p, q - p)) {
+            *pos = p - begin;
+            *len = q - p;
+            return Found;
+        }
+        prev = 1;
+        p = q;
+    }
+    return NotFound;
+}
+
+/**
+  * A run of characters from a class, like [0-9]+ or \s*
+  */
+class ClassRunMatcher : public NativeMatcher
+{
+public:
+    ClassRunMatcher(const RegexNodePtr& node, int min);
+
+    const char* name() const { return "class run"; }
+
+    Result find(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                int* pos, int* len) const;
+
+private:
+    int member(ushort c) const {
+        if (c < 128)
+            return ascii[c];
+        if (node->caseInsensitive || (checkSurrogates && c >= 0xd800 && c <= 0xdfff))
+            return -1;
+        return node->matches(c);
+    }
+
+    const QChar* scan(const QChar* p, const QChar* stop, bool wanted) const;
+
+    RegexNodePtr node;
+    int min;
+    bool ascii[128];
+    bool checkSurrogates;
+
+    // Plain ranges are compared eight characters at a time
+    bool simd;
+    int rangeCount;
+    ushort lows[MaxSimdRanges];
+    ushort spans[MaxSimdRanges];
+};
+
+ClassRunMatcher::ClassRunMatcher(const RegexNodePtr& node, int min) :
+    node(node), min(min), simd(false), rangeCount(0)
+{
+    for (ushort c = 0; c < 128; c++) {
+        ascii[c] = node->matches(c);
+    }
+
+    // Letters and digits beyond the BMP are one character to the regex
+    // engine, but two code units here
+    const int unicodeFlags = RegexNode::Word | RegexNode::NotWord | RegexNode::Digit | RegexNode::NotDigit;
+    checkSurrogates = (node->type == RegexNode::Class && (node->classFlags & unicodeFlags));
+
+    QList<QPair<ushort, ushort> > ranges;
+    if (node->type == RegexNode::Char && !node->caseInsensitive) {
+        ranges << qMakePair(node->ch, node->ch);
+    } else if (node->type == RegexNode::Class && !node->negated && !node->caseInsensitive && !node->classFlags) {
+        ranges = node->ranges;
+    }
+    if (!ranges.isEmpty() && ranges.size() <= MaxSimdRanges) {
+        simd = true;
+        for (int i = 0; i < ranges.size(); i++) {
+            lows[i] = ranges[i].first;
+            spans[i] = ranges[i].second - ranges[i].first;
+        }
+        rangeCount = ranges.size();
+    }
+}
+
+/**
+  * Returns the first position from p where membership is wanted, stop if
+  * there is none, or 0 if it can't be decided.
+  */
+const QChar* ClassRunMatcher::scan(const QChar* p, const QChar* stop, bool wanted) const
+{
+#if defined(__SSE2__)
+    if (simd) {
+        const __m128i zero = _mm_setzero_si128();
+        while (stop - p >= 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i in = zero;
+            for (int i = 0; i < rangeCount; i++) {
+                // c - low <= span, unsigned
+                __m128i d = _mm_sub_epi16(x, _mm_set1_epi16(lows[i]));
+                in = _mm_or_si128(in, _mm_cmpeq_epi16(_mm_subs_epu16(d, _mm_set1_epi16(spans[i])), zero));
+            }
+            int bits = _mm_movemask_epi8(in);
+            if (!wanted)
+                bits = ~bits & 0xffff;
+            if (bits) {
+                while (!(bits & 1)) {
+                    bits >>= 2;
+                    p++;
+                }
+                return p;
+            }
+            p += 8;
+        }
+    }
+#endif
+
+    for (; p < stop; p++) {
+        int m = member(p->unicode());
+        if (m == -1)
+            return 0;
+        if (bool(m) == wanted)
+            return p;
+    }
+    return stop;
+}
+
+NativeMatcher::Result ClassRunMatcher::find(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                                              int* pos, int* len) const
+{
+    const QChar* p = offset;
+    if (min > 0) {
+        const QChar* stop = qMin(range + 1, end);
+        p = scan(offset, stop, true);
+        if (!p)
+            return Unknown;
+        if (p == stop)
+            return NotFound;
+    }
+
+    const QChar* q = scan(p, end, false);
+    if (!q)
+        return Unknown;
+
+    *pos = p - begin;
+    *len = q - p;
+    return Found;
+}
+}
+
+NativeMatcher::NativeMatcher() :
+    groups(0)
+{
+}
+
+NativeMatcher::~NativeMatcher()
+{
+}
+
+int NativeMatcher::captureCount() const
+{
+    return groups;
+}
+
+NativeMatcher::Result NativeMatcher::search(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                                            int* captures) const
+{
+    int pos;
+    int len;
+    Result result = find(begin, end, offset, range, &pos, &len);
+    if (result == Found) {
+        for (int i = 0; i <= groups; i++) {
+            captures[2 * i] = pos;
+            captures[2 * i + 1] = pos + len;
+        }
+    }
+    return result;
+}
+
+RegexEngine* NativeMatcher::create(const RegexNodePtr& root, int captureCount)
+{
+    if (!root || captureCount > 1)
+        return 0;
+
+    // A capture group is fine if it spans the whole match
+    int groups = 0;
+    RegexNodePtr node = unwrap(root, &groups);
+    NativeMatcher* matcher = 0;
+
+    QString literal;
+    if (literalString(node, &literal)) {
+        matcher = new LiteralMatcher(literal);
+    }
+
+    // \b word \b, or \b (word|word|...) \b
+    if (!matcher && node->type == RegexNode::Concat && node->children.size() >= 3
+            && node->children.first()->type == RegexNode::Assertion
+            && node->children.first()->assertion == RegexNode::WordBoundary
+            && node->children.last()->type == RegexNode::Assertion
+            && node->children.last()->assertion == RegexNode::WordBoundary) {
+        QList<RegexNodePtr> middle = node->children.mid(1, node->children.size() - 2);
+        RegexNodePtr inner;
+        if (middle.size() == 1) {
+            inner = unwrap(middle.first(), &groups);
+        } else {
+            inner = RegexNodePtr(new RegexNode(RegexNode::Concat));
+            inner->children = middle;
+        }
+
+        QList<RegexNodePtr> alternatives;
+        if (inner->type == RegexNode::Alternation)
+            alternatives = inner->children;
+        else
+            alternatives << inner;
+
+        QStringList words;
+        foreach (const RegexNodePtr& alternative, alternatives) {
+            QString word;
+            if (!literalString(alternative, &word)) {
+                words.clear();
+                break;
+            }
+            bool isWord = true;
+            foreach (QChar c, word) {
+                isWord = isWord && isAsciiWordChar(c.unicode());
+            }
+            if (!isWord) {
+                words.clear();
+                break;
+            }
+            words << word;
+        }
+        if (!words.isEmpty())
+            matcher = new KeywordMatcher(words);
+    }
+
+    // [...]+ and [...]*, greedy or possessive
+    if (!matcher) {
+        RegexNodePtr repeat = node;
+        if (repeat->type == RegexNode::Atomic)
+            repeat = repeat->children[0];
+        if (repeat->type == RegexNode::Repeat && repeat->max == -1 && repeat->min <= 1
+                && (repeat->greedy || repeat != node)) {
+            RegexNodePtr item = repeat->children[0];
+            // A character that folds to several matches more than one
+            if ((item->type == RegexNode::Any || item->type == RegexNode::Char
+                    || (item->type == RegexNode::Class && !item->opaque)) && !item->hasMultiCharFolds()) {
+                matcher = new ClassRunMatcher(item, repeat->min);
+            }
+        }
+    }
+
+    if (matcher && groups != captureCount) {
+        // Some capture is not around the whole match
+        delete matcher;
+        matcher = 0;
+    }
+    if (matcher)
+        matcher->groups = groups;
+    return matcher;
+}
@@ -0,0 +1,46 @@
+#ifndef NATIVEMATCHER_H
+#define NATIVEMATCHER_H
+
+#include "regexengine.h"
+
+/**
+  * Matches a simple pattern shape without a regex engine.
+  *
+  * Recognized shapes are literal strings, keyword lists like
+  * \b(if|else|while)\b, and runs of a character class like [0-9]+. The whole
+  * pattern may be in one capture group, which then spans the whole match.
+  */
+class NativeMatcher : public RegexEngine
+{
+public:
+    ~NativeMatcher();
+
+    /**
+      * Returns a matcher for the parsed pattern, or 0 if the shape is not
+      * recognized. The caller takes ownership.
+      */
+    static RegexEngine* create(const RegexNodePtr& root, int captureCount);
+
+    /**
+      * Returns 0 or 1
+      */
+    int captureCount() const;
+
+    Result search(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                  int* captures) const;
+
+protected:
+    NativeMatcher();
+
+    /**
+      * Find the whole match, and store it as a position and length relative
+      * to begin
+      */
+    virtual Result find(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                        int* pos, int* len) const = 0;
+
+private:
+    int groups;
+};
+
+#endif // NATIVEMATCHER_H
@@ -0,0 +1,522 @@
+#include "pikevm.h"
+
+namespace {
+
+const int MaxInstructions = 5000;
+
+inline bool isSurrogate(ushort c)
+{
+    return c >= 0xd800 && c <= 0xdfff;
+}
+
+inline ushort toLowerAscii(ushort c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/**
+  * Returns true if an ASCII letter has a case variant outside ASCII that
+  * Oniguruma folds to it, like U+212A KELVIN SIGN for k, or starts the
+  * string that one folds to, like U+FB00 LATIN SMALL LIGATURE FF for ff
+  */
+inline bool hasNonAsciiFold(ushort c)
+{
+    c = toLowerAscii(c);
+    return c == 'k' || c == 's' || c == 'f';
+}
+
+bool nullable(const RegexNodePtr& node)
+{
+    switch (node->type) {
+    case RegexNode::Empty:
+    case RegexNode::Assertion:
+        return true;
+    case RegexNode::Group:
+        return nullable(node->children.first());
+    case RegexNode::Concat:
+        foreach (const RegexNodePtr& child, node->children) {
+            if (!nullable(child))
+                return false;
+        }
+        return true;
+    case RegexNode::Alternation:
+        foreach (const RegexNodePtr& child, node->children) {
+            if (nullable(child))
+                return true;
+        }
+        return false;
+    case RegexNode::Repeat:
+        return node->min == 0 || nullable(node->children.first());
+    default:
+        return false;
+    }
+}
+
+}
+
+/**
+  * The threads at one position, in priority order. An instruction is added
+  * at most once per position, so there's room for one thread each.
+  */
+struct PikeVM::ThreadList {
+    QVector<int> pcs;
+    QVector<int> captures;  // captureSlots for each thread
+    int size;
+};
+
+/**
+  * An instruction for add() to follow, or a capture slot to restore when
+  * the paths through a Save are done
+  */
+struct PikeVM::Step {
+    int pc;         // -1 to restore
+    int slot;
+    int value;
+};
+
+struct PikeVM::Scratch {
+    ThreadList lists[2];
+
+    // The position each instruction was last added to a list for
+    QVector<int> added;
+
+    // No captures set, where each match attempt starts
+    QVector<int> initial;
+
+    // The captures of the path add() follows, and what it has left to do
+    QVector<int> captures;
+    QVector<Step> stack;
+};
+
+struct PikeVM::State {
+    const QChar* begin;
+    const QChar* end;
+    const QChar* offset;
+    int captureSlots;
+    Scratch* scratch;
+};
+
+PikeVM::PikeVM()
+    : groups(0)
+    , hasFirstChars(false)
+{
+}
+
+PikeVM::~PikeVM()
+{
+    qDeleteAll(available);
+}
+
+RegexEngine* PikeVM::create(const RegexNodePtr& root, int captureCount)
+{
+    PikeVM* vm = new PikeVM;
+    vm->groups = captureCount;
+    vm->addInstruction(Instruction::Save, 0);
+    if (!vm->compile(root)) {
+        delete vm;
+        return 0;
+    }
+    vm->addInstruction(Instruction::Save, 1);
+    vm->addInstruction(Instruction::Match);
+
+    vm->hasFirstChars = regexFirstChars(root, &vm->firstChars);
+    return vm;
+}
+
+const char* PikeVM::name() const
+{
+    return "pike vm";
+}
+
+int PikeVM::captureCount() const
+{
+    return groups;
+}
+
+int PikeVM::addInstruction(Instruction::Op op, int x, int y)
+{
+    Instruction instruction;
+    instruction.op = op;
+    instruction.ch = 0;
+    instruction.caseInsensitive = false;
+    instruction.x = x;
+    instruction.y = y;
+    program.append(instruction);
+    return program.size() - 1;
+}
+
+bool PikeVM::compile(const RegexNodePtr& node)
+{
+    if (program.size() > MaxInstructions)
+        return false;
+
+    switch (node->type) {
+    case RegexNode::Empty:
+        return true;
+
+    case RegexNode::Char:
+        if (node->caseInsensitive && node->ch >= 128)
+            return false;
+        addInstruction(Instruction::Char);
+        program.last().ch = node->caseInsensitive ? toLowerAscii(node->ch) : node->ch;
+        program.last().caseInsensitive = node->caseInsensitive;
+        return true;
+
+    case RegexNode::Class:
+    case RegexNode::Any: {
+        if (node->type == RegexNode::Class) {
+            if (node->opaque)
+                return false;
+            if (node->caseInsensitive) {
+                for (int i = 0; i < node->ranges.size(); ++i) {
+                    if (node->ranges.at(i).second >= 128)
+                        return false;
+                }
+            }
+        }
+        CharClass cc;
+        cc.node = node;
+        for (ushort c = 0; c < 128; ++c)
+            cc.ascii[c] = node->matches(c);
+        classes.append(cc);
+        addInstruction(Instruction::Class, classes.size() - 1);
+        program.last().caseInsensitive = node->type == RegexNode::Class && node->caseInsensitive;
+        return true;
+    }
+
+    case RegexNode::Assertion:
+        addInstruction(Instruction::Assert, node->assertion);
+        return true;
+
+    case RegexNode::Group:
+        if (node->capture > 0) {
+            addInstruction(Instruction::Save, 2 * node->capture);
+            if (!compile(node->children.first()))
+                return false;
+            addInstruction(Instruction::Save, 2 * node->capture + 1);
+            return true;
+        }
+        return compile(node->children.first());
+
+    case RegexNode::Concat:
+        foreach (const RegexNodePtr& child, node->children) {
+            if (!compile(child))
+                return false;
+        }
+        return true;
+
+    case RegexNode::Alternation: {
+        // Split to each alternative in turn, all jumping to the end
+        QVector<int> jumps;
+        for (int i = 0; i < node->children.size(); ++i) {
+            int split = -1;
+            if (i < node->children.size() - 1)
+                split = addInstruction(Instruction::Split, program.size() + 1);
+            if (!compile(node->children.at(i)))
+                return false;
+            if (split != -1) {
+                jumps.append(addInstruction(Instruction::Jump));
+                program[split].y = program.size();
+            }
+        }
+        foreach (int jump, jumps)
+            program[jump].x = program.size();
+        return true;
+    }
+
+    case RegexNode::Repeat: {
+        const RegexNodePtr& child = node->children.first();
+
+        // An empty iteration stops a backtracking engine from repeating,
+        // and leaves captures in ways that aren't modeled here
+        if (node->max != 1 && nullable(child))
+            return false;
+
+        for (int i = 0; i < node->min; ++i) {
+            if (!compile(child))
+                return false;
+        }
+
+        if (node->max == -1) {
+            int split = addInstruction(Instruction::Split);
+            if (!compile(child))
+                return false;
+            addInstruction(Instruction::Jump, split);
+            if (node->greedy) {
+                program[split].x = split + 1;
+                program[split].y = program.size();
+            } else {
+                program[split].x = program.size();
+                program[split].y = split + 1;
+            }
+            return true;
+        }
+
+        // Nested optional copies, each one skipping to the end
+        QVector<int> splits;
+        for (int i = node->min; i < node->max; ++i) {
+            splits.append(addInstruction(Instruction::Split));
+            if (!compile(child))
+                return false;
+        }
+        foreach (int split, splits) {
+            if (node->greedy) {
+                program[split].x = split + 1;
+                program[split].y = program.size();
+            } else {
+                program[split].x = program.size();
+                program[split].y = split + 1;
+            }
+        }
+        return true;
+    }
+
+    default:
+        // Backreferences, lookaround and atomic groups need backtracking
+        return false;
+    }
+}
+
+/**
+  * Returns 1 if the code unit is consumed by the instruction, 0 if not, and
+  * -1 if it's up to Oniguruma
+  */
+int PikeVM::test(const Instruction& instruction, ushort c) const
+{
+    if (instruction.op == Instruction::Char) {
+        if (!instruction.caseInsensitive)
+            return c == instruction.ch;
+        if (c < 128)
+            return toLowerAscii(c) == instruction.ch;
+        return hasNonAsciiFold(instruction.ch) ? -1 : 0;
+    }
+
+    const CharClass& cc = classes.at(instruction.x);
+    if (c < 128)
+        return cc.ascii[c];
+    if (instruction.caseInsensitive)
+        return -1;
+    return cc.node->matches(c);
+}
+
+/**
+  * Returns 1 if the assertion holds at p, 0 if not, and -1 if it's up to
+  * Oniguruma
+  */
+int PikeVM::check(int assertion, const QChar* p, const State& state) const
+{
+    switch (assertion) {
+    case RegexNode::LineStart:
+        return p == state.begin || (p < state.end && p[-1] == QLatin1Char('\n'));
+    case RegexNode::LineEnd:
+        return p == state.end || *p == QLatin1Char('\n');
+    case RegexNode::TextStart:
+        return p == state.begin;
+    case RegexNode::TextEnd:
+        return p == state.end;
+    case RegexNode::TextEndOrNewline:
+        return p == state.end || (p + 1 == state.end && *p == QLatin1Char('\n'));
+    case RegexNode::SearchStart:
+        return p == state.offset;
+    case RegexNode::WordBoundary:
+    case RegexNode::NotWordBoundary: {
+        ushort before = p > state.begin ? p[-1].unicode() : 0;
+        ushort after = p < state.end ? p->unicode() : 0;
+        if (isSurrogate(before) || isSurrogate(after))
+            return -1;
+        bool boundary = (p > state.begin && regexIsWordChar(before))
+                != (p < state.end && regexIsWordChar(after));
+        return assertion == RegexNode::WordBoundary ? boundary : !boundary;
+    }
+    default:
+        return -1;
+    }
+}
+
+/**
+  * Adds the thread at pc to the list, following all paths that don't consume
+  * anything, in priority order. Returns -1 if an assertion is up to
+  * Oniguruma, otherwise 0.
+  *
+  * The paths are followed depth first from a stack. A Save changes the
+  * captures in place, and leaves a step below its path to undo the change.
+  */
+int PikeVM::add(ThreadList& list, int pc, const QChar* p, const int* captures, State& state) const
+{
+    const int position = p - state.begin;
+    int* added = state.scratch->added.data();
+    int* current = state.scratch->captures.data();
+    Step* stack = state.scratch->stack.data();
+    qCopy(captures, captures + state.captureSlots, current);
+
+    int top = 0;
+    stack[top].pc = pc;
+    top++;
+    while (top > 0) {
+        const Step step = stack[--top];
+        if (step.pc < 0) {
+            current[step.slot] = step.value;
+            continue;
+        }
+
+        pc = step.pc;
+        if (added[pc] == position)
+            continue;
+        added[pc] = position;
+
+        const Instruction& instruction = program.at(pc);
+        switch (instruction.op) {
+        case Instruction::Jump:
+            stack[top++].pc = instruction.x;
+            break;
+
+        case Instruction::Split:
+            // The preferred path is on top
+            stack[top++].pc = instruction.y;
+            stack[top++].pc = instruction.x;
+            break;
+
+        case Instruction::Save:
+            stack[top].pc = -1;
+            stack[top].slot = instruction.x;
+            stack[top].value = current[instruction.x];
+            top++;
+            current[instruction.x] = position;
+            stack[top++].pc = pc + 1;
+            break;
+
+        case Instruction::Assert: {
+            int holds = check(instruction.x, p, state);
+            if (holds < 0)
+                return -1;
+            if (holds)
+                stack[top++].pc = pc + 1;
+            break;
+        }
+
+        default:
+            list.pcs.data()[list.size] = pc;
+            qCopy(current, current + state.captureSlots, list.captures.data() + list.size * state.captureSlots);
+            list.size++;
+            break;
+        }
+    }
+    return 0;
+}
+
+PikeVM::Scratch* PikeVM::acquire() const
+{
+    {
+        QMutexLocker lock(&mutex);
+        if (!available.isEmpty())
+            return available.takeLast();
+    }
+
+    // Every instruction is followed at most once per add(), and pushes at
+    // most two steps
+    const int captureSlots = 2 * (groups + 1);
+    Scratch* scratch = new Scratch;
+    for (int i = 0; i < 2; ++i) {
+        scratch->lists[i].pcs.resize(program.size());
+        scratch->lists[i].captures.resize(program.size() * captureSlots);
+        scratch->lists[i].size = 0;
+    }
+    scratch->added.resize(program.size());
+    scratch->initial.fill(-1, captureSlots);
+    scratch->captures.resize(captureSlots);
+    scratch->stack.resize(2 * program.size() + 1);
+    return scratch;
+}
+
+void PikeVM::release(Scratch* scratch) const
+{
+    QMutexLocker lock(&mutex);
+    available.append(scratch);
+}
+
+RegexEngine::Result PikeVM::search(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                                   int* captures) const
+{
+    State state;
+    state.begin = begin;
+    state.end = end;
+    state.offset = offset;
+    state.captureSlots = 2 * (groups + 1);
+    state.scratch = acquire();
+    Result result = search(range, captures, state);
+    release(state.scratch);
+    return result;
+}
+
+RegexEngine::Result PikeVM::search(const QChar* range, int* captures, State& state) const
+{
+    const QChar* const end = state.end;
+    const int* initial = state.scratch->initial.constData();
+    int* added = state.scratch->added.data();
+    for (int i = 0; i < program.size(); ++i)
+        added[i] = -1;
+
+    ThreadList* current = &state.scratch->lists[0];
+    ThreadList* next = &state.scratch->lists[1];
+    current->size = 0;
+
+    bool matched = false;
+    const QChar* stop = qMin(range + 1, end + 1);
+
+    for (const QChar* p = state.offset; ; ++p) {
+        // Start a new match attempt here, with the lowest priority
+        if (!matched && p < stop) {
+            if (current->size == 0 && hasFirstChars) {
+                const QChar* limit = qMin(stop, end);
+                while (p < limit && !firstChars.contains(p->unicode()))
+                    ++p;
+                if (p == limit)
+                    break;
+            }
+            if (add(*current, 0, p, initial, state) < 0)
+                return Unknown;
+        }
+
+        if (current->size == 0) {
+            if (matched || p == end || p + 1 >= stop)
+                break;
+            continue;
+        }
+
+        ushort c = 0;
+        if (p < end) {
+            c = p->unicode();
+            if (isSurrogate(c))
+                return Unknown;
+        }
+
+        next->size = 0;
+        const int* pcs = current->pcs.constData();
+        for (int i = 0; i < current->size; ++i) {
+            const Instruction& instruction = program.at(pcs[i]);
+            const int* threadCaptures = current->captures.constData() + i * state.captureSlots;
+
+            if (instruction.op == Instruction::Match) {
+                // Paths with lower priority would have been tried later
+                qCopy(threadCaptures, threadCaptures + state.captureSlots, captures);
+                matched = true;
+                break;
+            }
+
+            if (p == end)
+                continue;
+
+            int consumed = test(instruction, c);
+            if (consumed < 0)
+                return Unknown;
+            if (consumed && add(*next, pcs[i] + 1, p + 1, threadCaptures, state) < 0)
+                return Unknown;
+        }
+
+        qSwap(current, next);
+        if (p == end)
+            break;
+    }
+
+    return matched ? Found : NotFound;
+}
@@ -0,0 +1,91 @@
+#ifndef PIKEVM_H
+#define PIKEVM_H
+
+#include "regexengine.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+/**
+  * Matches a pattern by following all paths through it at once (a Pike VM),
+  * in time linear in the length of the text, without backtracking.
+  *
+  * Paths are kept in the order a backtracking engine would try them, so
+  * matches and captures are the same as Oniguruma's. Patterns with
+  * backreferences, lookaround or atomic groups are not supported.
+  */
+class PikeVM : public RegexEngine
+{
+public:
+    /**
+      * Returns an engine for the parsed pattern, or 0 if it's not supported.
+      * The caller takes ownership.
+      */
+    static RegexEngine* create(const RegexNodePtr& root, int captureCount);
+
+    ~PikeVM();
+
+    const char* name() const;
+    int captureCount() const;
+
+    Result search(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                  int* captures) const;
+
+private:
+    struct Instruction {
+        enum Op {
+            Char,       // Consume ch
+            Class,      // Consume a member of classes[x]
+            Split,      // Continue at x, and with lower priority at y
+            Jump,       // Continue at x
+            Save,       // Store the position in capture slot x
+            Assert,     // Continue if assertion x holds
+            Match
+        };
+
+        Op op;
+        ushort ch;
+        bool caseInsensitive;
+        int x;
+        int y;
+    };
+
+    struct CharClass {
+        RegexNodePtr node;
+        bool ascii[128];
+    };
+
+    struct ThreadList;
+    struct Step;
+    struct Scratch;
+    struct State;
+
+    PikeVM();
+
+    bool compile(const RegexNodePtr& node);
+    int addInstruction(Instruction::Op op, int x = 0, int y = 0);
+
+    int test(const Instruction& instruction, ushort c) const;
+    int check(int assertion, const QChar* p, const State& state) const;
+    Result search(const QChar* range, int* captures, State& state) const;
+    int add(ThreadList& list, int pc, const QChar* p, const int* captures, State& state) const;
+
+    Scratch* acquire() const;
+    void release(Scratch* scratch) const;
+
+    QVector<Instruction> program;
+    QVector<CharClass> classes;
+    int groups;
+
+    // Where a match can start, to skip ahead when no path is active
+    bool hasFirstChars;
+    RegexCharSet firstChars;
+
+    // The lists and stacks of a search, reused by the next one. Concurrent
+    // searches need one each.
+    mutable QMutex mutex;
+    mutable QList<Scratch*> available;
+};
+
+#endif // PIKEVM_H
@@ -1,34 +1,134 @@
 #include "plistreader.h"
 
-#include <QtXml/QXmlStreamReader>
 #include <QFile>
+#include <QScopedPointer>
+#include <QTextStream>
 
 #include <QtDebug>
 
-PlistReader::PlistReader(QObject* parent)
-    : QObject(parent)
+namespace {
+
+// Deeper nesting is taken as a broken file, a binary one may even refer
+// to its own containers
+const int MaxDepth = 512;
+
+// Unused bytes, sort version, offset size and reference size, object
+// count, top object, and offset table offset
+const int BinaryTrailerSize = 32;
+
+}
+
+PlistStream::~PlistStream()
 {
 }
 
-QVariant PlistReader::read(const QString &path)
+PlistStream* PlistStream::open(const QString& path)
 {
     QFile file(path);
     if (file.open(QFile::ReadOnly)) {
-        return read(file);
-    } else {
+        switch (detectFormat(&file)) {
+        case BinaryFormat:
+            return new PlistBinaryStream(file.readAll());
+        case JsonFormat:
+            return new PlistJsonStream(file.readAll());
+        default:
+            break;
+        }
+    }
+    return new PlistXmlStream(path);
+}
+
+PlistStream* PlistStream::open(QIODevice* device)
+{
+    switch (detectFormat(device)) {
+    case BinaryFormat:
+        return new PlistBinaryStream(device->readAll());
+    case JsonFormat:
+        return new PlistJsonStream(device->readAll());
+    default:
+        return new PlistXmlStream(device);
+    }
+}
+
+PlistStream::Format PlistStream::detectFormat(QIODevice* device)
+{
+    const QByteArray start = device->peek(64);
+    if (start.startsWith("bplist00"))
+        return BinaryFormat;
+
+    // JSON starts with an object or array, after an optional byte order mark
+    int i = start.startsWith("\xef\xbb\xbf") ? 3 : 0;
+    while (i < start.size() && (start.at(i) == ' ' || start.at(i) == '\t'
+                                || start.at(i) == '\n' || start.at(i) == '\r'))
+        i++;
+    if (i < start.size() && (start.at(i) == '{' || start.at(i) == '['))
+        return JsonFormat;
+    return XmlFormat;
+}
+
+void PlistStream::skip()
+{
+    Type type;
+    while ((type = next()) != End) {
+        if (type == Array || type == Dict)
+            skip();
+    }
+}
+
+bool PlistStream::hasError() const
+{
+    return false;
+}
+
+QVariant PlistStream::readValue(Type type)
+{
+    switch (type) {
+    case String:
+        return text();
+    case Integer:
+        return integer();
+    case Array: {
+        QVariantList array;
+        while ((type = next()) != End)
+            array.append(readValue(type));
+        return array;
+    }
+    case Dict: {
+        QVariantMap map;
+        while ((type = next()) != End) {
+            QString name = key();
+            map.insert(name, readValue(type));
+        }
+        return map;
+    }
+    default:
         return QVariant();
     }
 }
 
-QVariant PlistReader::read(QIODevice &device)
+PlistXmlStream::PlistXmlStream(QIODevice* device)
+    : reader(device)
+    , currentInteger(0)
+    , errorReported(false)
 {
-    QXmlStreamReader reader(&device);
-    return readDocument(reader);
 }
 
-QVariant PlistReader::readDocument(QXmlStreamReader& reader)
+PlistXmlStream::PlistXmlStream(const QString& path)
+    : file(path)
+    , currentInteger(0)
+    , errorReported(false)
 {
-    QVariant value;
+    if (file.open(QFile::ReadOnly)) {
+        reader.setDevice(&file);
+    }
+}
+
+PlistStream::Type PlistXmlStream::next()
+{
+    // A file that couldn't be opened reads as empty
+    if (!reader.device())
+        return End;
+
     while (!reader.atEnd()) {
         reader.readNext();
         switch (reader.tokenType()) {
@@ -40,11 +140,28 @@ QVariant PlistReader::readDocument(QXmlStreamReader& reader)
             }
             break;
         case QXmlStreamReader::StartElement:
-            if (reader.name() != "plist") {
-                value = readElement(reader);
+            if (reader.name() == "plist") {
+                break;
             }
-            break;
+            if (!inDict.isEmpty() && inDict.last()) {
+                if (reader.name() == "key") {
+                    pendingKey = reader.readElementText();
+                    break;
+                }
+                if (pendingKey.isNull()) {
+                    qWarning() << "Expected key, got" << reader.name();
+                    reader.skipCurrentElement();
+                    break;
+                }
+            }
+            currentKey = pendingKey;
+            pendingKey.clear();
+            return readElement();
         case QXmlStreamReader::EndElement:
+            if (reader.name() == "array" || reader.name() == "dict") {
+                inDict.pop_back();
+                return End;
+            }
             if (reader.name() != "plist") {
                 qWarning() << "Unexpected end tag:" << reader.name();
             }
@@ -54,107 +171,579 @@ QVariant PlistReader::readDocument(QXmlStreamReader& reader)
         case QXmlStreamReader::Comment:
             break;
         default:
-            readWhiteSpace(reader);
+            readWhiteSpace();
             break;
         }
     }
-    if (reader.hasError()) {
+    if (reader.hasError() && !errorReported) {
         qWarning() << reader.errorString();
-        return QVariant();
+        errorReported = true;
     }
-    return value;
+    return End;
 }
 
-QVariant PlistReader::readElement(QXmlStreamReader &reader) {
+PlistStream::Type PlistXmlStream::readElement()
+{
     if (reader.name() == "string") {
-        return readElementString(reader);
+        currentText = reader.readElementText();
+        return String;
     } else if (reader.name() == "integer") {
-        return readElementInteger(reader);
+        QString data = reader.readElementText();
+        QTextStream ts(&data);
+        ts >> currentInteger;
+        return Integer;
     } else if (reader.name() == "array") {
-        return readElementArray(reader);
+        inDict.append(false);
+        return Array;
     } else if (reader.name() == "dict") {
-        return readElementDict(reader);
+        inDict.append(true);
+        return Dict;
     } else {
         qWarning() << "Don't know how to read element" << reader.name();
         reader.readElementText(QXmlStreamReader::IncludeChildElements);
-        return QVariant();
+        return Unknown;
     }
 }
 
-QVariant PlistReader::readElementString(QXmlStreamReader &reader)
+QString PlistXmlStream::key() const
 {
-    return reader.readElementText();
+    return currentKey;
 }
 
-QVariant PlistReader::readElementInteger(QXmlStreamReader &reader)
+QString PlistXmlStream::text() const
 {
-    QString data = reader.readElementText();
-    QTextStream ts(&data);
-    int i;
-    ts >> i;
-    return QVariant(i);
+    return currentText;
 }
 
-QVariant PlistReader::readElementArray(QXmlStreamReader& reader)
+int PlistXmlStream::integer() const
 {
-    QVariantList array;
-    while (!reader.atEnd()) {
-        reader.readNext();
-        switch (reader.tokenType()) {
-        case QXmlStreamReader::StartElement:
-            array.append(readElement(reader));
+    return currentInteger;
+}
+
+void PlistXmlStream::skip()
+{
+    reader.skipCurrentElement();
+    inDict.pop_back();
+    pendingKey.clear();
+}
+
+bool PlistXmlStream::hasError() const
+{
+    return reader.hasError();
+}
+
+void PlistXmlStream::readWhiteSpace()
+{
+    if (reader.tokenType() != QXmlStreamReader::Characters) {
+        qWarning() << "Don't know what to do with" << reader.tokenString();
+    } else if (!reader.isWhitespace()) {
+        qWarning() << "Unexpected content:" << reader.text();
+    }
+}
+
+PlistBinaryStream::PlistBinaryStream(const QByteArray& data)
+    : data(data)
+    , offsetSize(0)
+    , refSize(0)
+    , objectCount(0)
+    , topObject(0)
+    , offsetTable(0)
+    , started(false)
+    , error(false)
+    , currentInteger(0)
+{
+    const qint64 size = data.size();
+    if (size < 8 + BinaryTrailerSize || !data.startsWith("bplist00")) {
+        fail("Not a binary property list");
+        return;
+    }
+
+    const qint64 trailer = size - BinaryTrailerSize;
+    offsetSize = uchar(data.at(trailer + 6));
+    refSize = uchar(data.at(trailer + 7));
+    objectCount = readInteger(trailer + 8, 8);
+    topObject = readInteger(trailer + 16, 8);
+    const quint64 tableOffset = readInteger(trailer + 24, 8);
+    if (offsetSize < 1 || offsetSize > 8 || refSize < 1 || refSize > 8
+            || tableOffset < 8 || tableOffset > quint64(trailer)
+            || objectCount > (quint64(trailer) - tableOffset) / offsetSize
+            || topObject >= objectCount) {
+        fail("Invalid binary property list trailer");
+        return;
+    }
+    offsetTable = tableOffset;
+}
+
+PlistStream::Type PlistBinaryStream::next()
+{
+    if (error)
+        return End;
+
+    quint64 ref;
+    if (levels.isEmpty()) {
+        if (started)
+            return End;
+        started = true;
+        currentKey.clear();
+        ref = topObject;
+    } else {
+        Level& level = levels.last();
+        if (level.index == level.count) {
+            levels.pop_back();
+            return End;
+        }
+        currentKey.clear();
+        if (level.dict && !readString(readRef(level.keyRefs + level.index * refSize), currentKey))
+            return fail("Invalid key in binary property list");
+        ref = readRef(level.valueRefs + level.index * refSize);
+        level.index++;
+    }
+    return readObject(ref);
+}
+
+QString PlistBinaryStream::key() const
+{
+    return currentKey;
+}
+
+QString PlistBinaryStream::text() const
+{
+    return currentText;
+}
+
+int PlistBinaryStream::integer() const
+{
+    return currentInteger;
+}
+
+void PlistBinaryStream::skip()
+{
+    if (!levels.isEmpty())
+        levels.pop_back();
+}
+
+bool PlistBinaryStream::hasError() const
+{
+    return error;
+}
+
+/**
+  * Reads a big endian integer. The offset must be valid.
+  */
+quint64 PlistBinaryStream::readInteger(qint64 offset, int size) const
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData()) + offset;
+    quint64 value = 0;
+    for (int i = 0; i < size; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+/**
+  * Reads an object reference from a container checked by readObject()
+  */
+quint64 PlistBinaryStream::readRef(qint64 offset) const
+{
+    return readInteger(offset, refSize);
+}
+
+/**
+  * Returns the offset of an object, or -1 if it's not a valid reference
+  */
+qint64 PlistBinaryStream::objectOffset(quint64 ref) const
+{
+    if (ref >= objectCount)
+        return -1;
+    const quint64 offset = readInteger(offsetTable + ref * offsetSize, offsetSize);
+    if (offset < 8 || offset >= quint64(offsetTable))
+        return -1;
+    return offset;
+}
+
+/**
+  * Reads the length of the object at offset, which is in the marker byte, or
+  * in an integer after it, and moves offset past it
+  */
+bool PlistBinaryStream::readLength(qint64& offset, quint64& length) const
+{
+    const int info = uchar(data.at(offset)) & 0xf;
+    offset++;
+    if (info != 0xf) {
+        length = info;
+        return true;
+    }
+    if (offset >= offsetTable)
+        return false;
+    const int marker = uchar(data.at(offset));
+    const int size = 1 << (marker & 0xf);
+    if (marker >> 4 != 0x1 || size > 8 || offset + 1 + size > offsetTable)
+        return false;
+    length = readInteger(offset + 1, size);
+    offset += 1 + size;
+    return length <= quint64(offsetTable);
+}
+
+PlistStream::Type PlistBinaryStream::readObject(quint64 ref)
+{
+    const qint64 offset = objectOffset(ref);
+    if (offset < 0)
+        return fail("Invalid object reference in binary property list");
+
+    const int marker = uchar(data.at(offset));
+    switch (marker >> 4) {
+    case 0x1: {
+        const int size = 1 << (marker & 0xf);
+        if (size > 8 || offset + 1 + size > offsetTable)
+            return fail("Invalid integer in binary property list");
+        currentInteger = int(readInteger(offset + 1, size));
+        return Integer;
+    }
+    case 0x5:
+    case 0x6:
+        if (!readString(ref, currentText))
+            return fail("Invalid string in binary property list");
+        return String;
+    case 0xa:
+    case 0xd: {
+        Level level;
+        level.dict = marker >> 4 == 0xd;
+        level.index = 0;
+        qint64 refs = offset;
+        if (!readLength(refs, level.count)
+                || refs + qint64(level.count) * (level.dict ? 2 : 1) * refSize > offsetTable)
+            return fail("Invalid container in binary property list");
+        if (levels.size() == MaxDepth)
+            return fail("Binary property list nested too deep");
+        level.keyRefs = refs;
+        level.valueRefs = level.dict ? refs + level.count * refSize : refs;
+        levels.append(level);
+        return level.dict ? Dict : Array;
+    }
+    default:
+        return Unknown;
+    }
+}
+
+/**
+  * Reads an ASCII or UTF-16 string object
+  */
+bool PlistBinaryStream::readString(quint64 ref, QString& str)
+{
+    qint64 offset = objectOffset(ref);
+    if (offset < 0)
+        return false;
+    const int type = uchar(data.at(offset)) >> 4;
+    quint64 length;
+    if ((type != 0x5 && type != 0x6) || !readLength(offset, length))
+        return false;
+
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData()) + offset;
+    if (type == 0x5) {
+        if (offset + qint64(length) > offsetTable)
+            return false;
+        str = QString::fromLatin1(reinterpret_cast<const char*>(p), length);
+    } else {
+        if (offset + 2 * qint64(length) > offsetTable)
+            return false;
+        str.resize(length);
+        for (quint64 i = 0; i < length; i++)
+            str[int(i)] = QChar(ushort(p[2 * i] << 8 | p[2 * i + 1]));
+    }
+    return true;
+}
+
+PlistStream::Type PlistBinaryStream::fail(const char* message)
+{
+    if (!error)
+        qWarning() << message;
+    error = true;
+    levels.clear();
+    return End;
+}
+
+PlistJsonStream::PlistJsonStream(const QByteArray& data)
+    : data(QString::fromUtf8(data.constData(), data.size()))
+    , pos(0)
+    , started(false)
+    , error(false)
+    , currentInteger(0)
+{
+    if (this->data.startsWith(QChar(0xfeff)))
+        pos = 1;
+}
+
+PlistStream::Type PlistJsonStream::next()
+{
+    if (error)
+        return End;
+
+    if (levels.isEmpty()) {
+        if (started)
+            return End;
+        started = true;
+        currentKey.clear();
+        return readValue();
+    }
+
+    Level& level = levels.last();
+    skipWhiteSpace();
+    if (pos < data.size() && data.at(pos) == QChar(level.dict ? '}' : ']')) {
+        pos++;
+        levels.pop_back();
+        return End;
+    }
+    if (!level.first && !expect(','))
+        return fail("Expected ','");
+    level.first = false;
+
+    currentKey.clear();
+    if (level.dict) {
+        skipWhiteSpace();
+        if (pos == data.size() || data.at(pos) != '"' || !readString(currentKey))
+            return fail("Expected key");
+        if (!expect(':'))
+            return fail("Expected ':'");
+    }
+    return readValue();
+}
+
+QString PlistJsonStream::key() const
+{
+    return currentKey;
+}
+
+QString PlistJsonStream::text() const
+{
+    return currentText;
+}
+
+int PlistJsonStream::integer() const
+{
+    return currentInteger;
+}
+
+bool PlistJsonStream::hasError() const
+{
+    return error;
+}
+
+void PlistJsonStream::skipWhiteSpace()
+{
+    while (pos < data.size()) {
+        const QChar c = data.at(pos);
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
             break;
-        case QXmlStreamReader::EndElement:
-            if (reader.name() == "array") {
-                return array;
-            } else {
-                qWarning() << "Unexpected end tag:" << reader.name();
-            }
+        pos++;
+    }
+}
+
+bool PlistJsonStream::expect(QChar c)
+{
+    skipWhiteSpace();
+    if (pos == data.size() || data.at(pos) != c)
+        return false;
+    pos++;
+    return true;
+}
+
+/**
+  * Reads the string starting at pos, and moves past it
+  */
+bool PlistJsonStream::readString(QString& str)
+{
+    str.clear();
+    pos++;
+    int start = pos;
+    while (pos < data.size()) {
+        const QChar c = data.at(pos);
+        if (c == '"') {
+            str += data.midRef(start, pos - start);
+            pos++;
+            return true;
+        }
+        if (c != '\\') {
+            pos++;
+            continue;
+        }
+
+        str += data.midRef(start, pos - start);
+        if (++pos == data.size())
+            return false;
+        switch (data.at(pos).unicode()) {
+        case '"':
+        case '\\':
+        case '/':
+            str += data.at(pos);
             break;
-        default:
-            readWhiteSpace(reader);
+        case 'b':
+            str += '\b';
+            break;
+        case 'f':
+            str += '\f';
+            break;
+        case 'n':
+            str += '\n';
+            break;
+        case 'r':
+            str += '\r';
             break;
+        case 't':
+            str += '\t';
+            break;
+        case 'u': {
+            // Surrogate pairs are two escapes, and end up as two QChars
+            bool ok;
+            const ushort code = data.mid(pos + 1, 4).toUShort(&ok, 16);
+            if (!ok || pos + 4 >= data.size())
+                return false;
+            str += QChar(code);
+            pos += 4;
+            break;
+        }
+        default:
+            return false;
         }
+        start = ++pos;
     }
-    return QVariant();
+    return false;
 }
 
-QVariant PlistReader::readElementDict(QXmlStreamReader& reader)
+PlistStream::Type PlistJsonStream::readValue()
 {
-    QMap<QString, QVariant> map;
-    QString pName;
-    while (!reader.atEnd()) {
-        reader.readNext();
-        switch (reader.tokenType()) {
-        case QXmlStreamReader::StartElement:
-            if (reader.name() == "key") {
-                pName = reader.readElementText();
-            } else if (!pName.isNull()) {
-                map.insert(pName, readElement(reader));
-                pName.clear();
-            } else {
-                qWarning() << "Expected key, got" << reader.name();
-            }
-            break;
-        case QXmlStreamReader::EndElement:
-            if (reader.name() == "dict") {
-                return map;
-            } else {
-                qWarning() << "Unexpected end tag:" << reader.name();
-            }
-        default:
-            readWhiteSpace(reader);
-            break;
+    skipWhiteSpace();
+    if (pos == data.size())
+        return fail("Unexpected end");
+
+    const QChar c = data.at(pos);
+    if (c == '"') {
+        if (!readString(currentText))
+            return fail("Invalid string");
+        return String;
+    }
+    if (c == '{' || c == '[') {
+        if (levels.size() == MaxDepth)
+            return fail("Nested too deep");
+        pos++;
+        Level level;
+        level.dict = c == '{';
+        level.first = true;
+        levels.append(level);
+        return level.dict ? Dict : Array;
+    }
+    if (c == '-' || c.isDigit()) {
+        const int start = pos;
+        while (pos < data.size() && (data.at(pos).isDigit() || data.at(pos) == '-' || data.at(pos) == '+'
+                                     || data.at(pos) == '.' || data.at(pos) == 'e' || data.at(pos) == 'E'))
+            pos++;
+        bool ok;
+        currentInteger = data.mid(start, pos - start).toInt(&ok);
+        return ok ? Integer : Unknown;
+    }
+
+    static const char* const literals[] = { "true", "false", "null" };
+    for (int i = 0; i < 3; i++) {
+        const QLatin1String literal(literals[i]);
+        if (data.midRef(pos, qstrlen(literals[i])) == literal) {
+            pos += qstrlen(literals[i]);
+            return Unknown;
         }
     }
-    return QVariant();
+    return fail("Unexpected character");
 }
 
-void PlistReader::readWhiteSpace(QXmlStreamReader &reader)
+PlistStream::Type PlistJsonStream::fail(const char* message)
 {
-    if (reader.tokenType() != QXmlStreamReader::Characters) {
-        qWarning() << "Don't know what to do with" << reader.tokenString();
-    } else if (!reader.isWhitespace()) {
-        qWarning() << "Unexpected content:" << reader.text();
+    if (!error)
+        qWarning() << "Invalid JSON:" << message << "at" << pos;
+    error = true;
+    levels.clear();
+    return End;
+}
+
+PlistVariantStream::PlistVariantStream(const QVariant& value)
+{
+    Level document;
+    document.values << value;
+    document.index = 0;
+    levels.append(document);
+}
+
+PlistStream::Type PlistVariantStream::next()
+{
+    if (levels.isEmpty())
+        return End;
+
+    Level& level = levels.last();
+    if (level.index == level.values.size()) {
+        levels.pop_back();
+        return End;
+    }
+    current = level.values.at(level.index);
+    currentKey = level.keys.isEmpty() ? QString() : level.keys.at(level.index);
+    level.index++;
+
+    switch (current.type()) {
+    case QVariant::String:
+        return String;
+    case QVariant::Int:
+        return Integer;
+    case QVariant::List: {
+        Level array;
+        array.values = current.toList();
+        array.index = 0;
+        levels.append(array);
+        return Array;
+    }
+    case QVariant::Map: {
+        const QVariantMap map = current.toMap();
+        Level dict;
+        dict.values = map.values();
+        dict.keys = map.keys();
+        dict.index = 0;
+        levels.append(dict);
+        return Dict;
     }
+    default:
+        return Unknown;
+    }
+}
+
+QString PlistVariantStream::key() const
+{
+    return currentKey;
+}
+
+QString PlistVariantStream::text() const
+{
+    return current.toString();
+}
+
+int PlistVariantStream::integer() const
+{
+    return current.toInt();
+}
+
+PlistReader::PlistReader(QObject* parent)
+    : QObject(parent)
+{
+}
+
+QVariant PlistReader::read(const QString &path)
+{
+    QFile file(path);
+    if (file.open(QFile::ReadOnly)) {
+        return read(file);
+    } else {
+        return QVariant();
+    }
+}
+
+QVariant PlistReader::read(QIODevice &device)
+{
+    QScopedPointer<PlistStream> stream(PlistStream::open(&device));
+    QVariant value = stream->readValue(stream->next());
+    if (stream->hasError()) {
+        return QVariant();
+    }
+    return value;
 }
@@ -2,10 +2,224 @@
 #define PLISTREADER_H
 
 #include <QObject>
+#include <QByteArray>
+#include <QFile>
 #include <QIODevice>
 #include <QVariant>
+#include <QVector>
 
-class QXmlStreamReader;
+#include <QtXml/QXmlStreamReader>
+
+/**
+  * Reads a property list one value at a time, without building a tree.
+  *
+  * next() moves to the next value in the current array or dict, and returns
+  * its type, or End after the last one. In a dict, key() is the key of the
+  * value. After next() returns Array or Dict, the following calls move
+  * through its values, unless it's skipped with skip(). The document itself
+  * is one value.
+  *
+  * Property lists can be XML, binary (bplist00) or JSON, see open().
+  */
+class PlistStream
+{
+public:
+    enum Type {
+        End,
+        String,
+        Integer,
+        Array,
+        Dict,
+        Unknown     // A value of a type that isn't supported
+    };
+
+    enum Format {
+        XmlFormat,
+        BinaryFormat,
+        JsonFormat
+    };
+
+    virtual ~PlistStream();
+
+    /**
+      * Returns a stream over the property list in a file or device, with a
+      * reader for its format. The caller takes ownership, and must keep the
+      * device open while the stream is used. A file that can't be read is
+      * empty.
+      */
+    static PlistStream* open(const QString& path);
+    static PlistStream* open(QIODevice* device);
+
+    /**
+      * Returns the format of the property list, from its first bytes
+      */
+    static Format detectFormat(QIODevice* device);
+
+    virtual Type next() = 0;
+    virtual QString key() const = 0;
+    virtual QString text() const = 0;
+    virtual int integer() const = 0;
+
+    /**
+      * Skips the values of the array or dict just moved to
+      */
+    virtual void skip();
+
+    virtual bool hasError() const;
+
+    /**
+      * Reads the value just moved to, with all its values
+      */
+    QVariant readValue(Type type);
+};
+
+/**
+  * A PlistStream reading XML
+  */
+class PlistXmlStream : public PlistStream
+{
+public:
+    explicit PlistXmlStream(QIODevice* device);
+    explicit PlistXmlStream(const QString& path);
+
+    Type next();
+    QString key() const;
+    QString text() const;
+    int integer() const;
+    void skip();
+    bool hasError() const;
+
+private:
+    Type readElement();
+    void readWhiteSpace();
+
+    QFile file;
+    QXmlStreamReader reader;
+
+    // True for each dict, false for each array being read
+    QVector<bool> inDict;
+
+    QString pendingKey;
+    QString currentKey;
+    QString currentText;
+    int currentInteger;
+    bool errorReported;
+};
+
+/**
+  * A PlistStream reading a binary property list.
+  *
+  * All objects are found through the offset table, so skip() doesn't read
+  * anything, and strings are only decoded when they're moved to.
+  */
+class PlistBinaryStream : public PlistStream
+{
+public:
+    explicit PlistBinaryStream(const QByteArray& data);
+
+    Type next();
+    QString key() const;
+    QString text() const;
+    int integer() const;
+    void skip();
+    bool hasError() const;
+
+private:
+    struct Level {
+        qint64 keyRefs;     // Offset of the key references, if a dict
+        qint64 valueRefs;
+        quint64 count;
+        quint64 index;
+        bool dict;
+    };
+
+    quint64 readInteger(qint64 offset, int size) const;
+    quint64 readRef(qint64 offset) const;
+    qint64 objectOffset(quint64 ref) const;
+    bool readLength(qint64& offset, quint64& length) const;
+    Type readObject(quint64 ref);
+    bool readString(quint64 ref, QString& str);
+    Type fail(const char* message);
+
+    QByteArray data;
+    int offsetSize;
+    int refSize;
+    quint64 objectCount;
+    quint64 topObject;
+    qint64 offsetTable;
+
+    bool started;
+    bool error;
+    QVector<Level> levels;
+
+    QString currentKey;
+    QString currentText;
+    int currentInteger;
+};
+
+/**
+  * A PlistStream reading JSON, as used for .tmLanguage.json files. Numbers
+  * that aren't integers, booleans and null are read as Unknown.
+  */
+class PlistJsonStream : public PlistStream
+{
+public:
+    explicit PlistJsonStream(const QByteArray& data);
+
+    Type next();
+    QString key() const;
+    QString text() const;
+    int integer() const;
+    bool hasError() const;
+
+private:
+    struct Level {
+        bool dict;
+        bool first;
+    };
+
+    void skipWhiteSpace();
+    bool expect(QChar c);
+    bool readString(QString& str);
+    Type readValue();
+    Type fail(const char* message);
+
+    QString data;
+    int pos;
+
+    bool started;
+    bool error;
+    QVector<Level> levels;
+
+    QString currentKey;
+    QString currentText;
+    int currentInteger;
+};
+
+/**
+  * A PlistStream over a value already read
+  */
+class PlistVariantStream : public PlistStream
+{
+public:
+    explicit PlistVariantStream(const QVariant& value);
+
+    Type next();
+    QString key() const;
+    QString text() const;
+    int integer() const;
+
+private:
+    struct Level {
+        QVariantList values;
+        QStringList keys;
+        int index;
+    };
+
+    QVector<Level> levels;
+    QString currentKey;
+    QVariant current;
+};
 
 class PlistReader : public QObject
 {
@@ -16,15 +230,6 @@ public:
 
     QVariant read(const QString& path);
     QVariant read(QIODevice& device);
-
-private:
-    QVariant readDocument(QXmlStreamReader& reader);
-    QVariant readElement(QXmlStreamReader& reader);
-    QVariant readElementString(QXmlStreamReader& reader);
-    QVariant readElementInteger(QXmlStreamReader& reader);
-    QVariant readElementArray(QXmlStreamReader& reader);
-    QVariant readElementDict(QXmlStreamReader& reader);
-    void readWhiteSpace(QXmlStreamReader& reader);
 };
 
 #endif // PLISTREADER_H
@@ -0,0 +1,197 @@
+#include "preferences.h"
+#include "plistreader.h"
+#include "scopeselector.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include <QtDebug>
+
+namespace {
+
+// Preferences are cached for this many scope stacks, then the cache starts over
+const int MaxCachedPreferences = 1024;
+
+void readShellVariables(PlistStream& stream, PreferenceData& preferences)
+{
+    PlistStream::Type type;
+    while ((type = stream.next()) != PlistStream::End) {
+        if (type != PlistStream::Dict) {
+            stream.readValue(type);
+            continue;
+        }
+        QString name;
+        QString value;
+        while ((type = stream.next()) != PlistStream::End) {
+            QString key = stream.key();
+            if (key == "name") {
+                name = stream.readValue(type).toString();
+            } else if (key == "value") {
+                value = stream.readValue(type).toString();
+            } else {
+                stream.readValue(type);
+            }
+        }
+        if (!name.isEmpty())
+            preferences.shellVariables[name] = value;
+    }
+}
+
+void readSmartTypingPairs(PlistStream& stream, PreferenceData& preferences)
+{
+    preferences.hasSmartTypingPairs = true;
+    PlistStream::Type type;
+    while ((type = stream.next()) != PlistStream::End) {
+        QStringList pair = stream.readValue(type).toStringList();
+        if (pair.size() == 2)
+            preferences.smartTypingPairs.append(qMakePair(pair.at(0), pair.at(1)));
+    }
+}
+
+void readSettings(PlistStream& stream, PreferenceData& preferences)
+{
+    PlistStream::Type type;
+    while ((type = stream.next()) != PlistStream::End) {
+        QString key = stream.key();
+        if (key == "shellVariables" && type == PlistStream::Array) {
+            readShellVariables(stream, preferences);
+        } else if (key == "smartTypingPairs" && type == PlistStream::Array) {
+            readSmartTypingPairs(stream, preferences);
+        } else if (type == PlistStream::String) {
+            preferences.settings[key] = stream.readValue(type).toString();
+        } else {
+            stream.readValue(type);
+        }
+    }
+}
+
+/**
+  * Adds the values of from to to. Values already in to are replaced,
+  * unless keep is true.
+  */
+void insertValues(QMap<QString, QString>& to, const QMap<QString, QString>& from, bool keep)
+{
+    QMap<QString, QString>::const_iterator it;
+    for (it = from.constBegin(); it != from.constEnd(); ++it) {
+        if (!keep || !to.contains(it.key()))
+            to.insert(it.key(), it.value());
+    }
+}
+
+}
+
+class PreferencesPrivate
+{
+    friend class Preferences;
+
+    // The files merged by selector, and the selectors of data by their
+    // position in it
+    QMap<ScopeSelector, PreferenceData> data;
+    ScopeSelectorIndex index;
+    QVector<PreferenceData> entries;
+
+    QHash<QString, Regex> regexes;      // By pattern
+    QHash<ScopeStackKey, ScopePreferences> cache;
+
+    Regex regex(const QString& pattern);
+};
+
+Regex PreferencesPrivate::regex(const QString& pattern)
+{
+    if (pattern.isEmpty())
+        return Regex();
+
+    QHash<QString, Regex>::const_iterator it = regexes.constFind(pattern);
+    if (it != regexes.constEnd())
+        return it.value();
+
+    Regex regex(pattern);
+    if (!regex.isValid())
+        qWarning() << "Invalid pattern in preferences:" << pattern << regex.error();
+    regexes.insert(pattern, regex);
+    return regex;
+}
+
+PreferenceData PreferenceData::read(PlistStream& stream)
+{
+    PreferenceData preferences;
+    PlistStream::Type type = stream.next();
+    if (type != PlistStream::Dict) {
+        stream.readValue(type);
+        return preferences;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        QString key = stream.key();
+        if (key == "scope") {
+            preferences.scope = stream.readValue(type).toString();
+        } else if (key == "settings" && type == PlistStream::Dict) {
+            readSettings(stream, preferences);
+        } else {
+            stream.readValue(type);
+        }
+    }
+    return preferences;
+}
+
+Preferences::Preferences() :
+    d(new PreferencesPrivate)
+{
+}
+
+Preferences::~Preferences()
+{
+}
+
+void Preferences::setPreferenceData(const QList<PreferenceData>& data)
+{
+    d = QSharedPointer<PreferencesPrivate>(new PreferencesPrivate);
+    foreach (const PreferenceData& file, data) {
+        foreach (const QString& selector, file.scope.split(",")) {
+            PreferenceData& merged = d->data[ScopeSelector(selector.trimmed())];
+            merged.scope = selector.trimmed();
+            insertValues(merged.settings, file.settings, false);
+            insertValues(merged.shellVariables, file.shellVariables, false);
+            if (file.hasSmartTypingPairs) {
+                merged.smartTypingPairs = file.smartTypingPairs;
+                merged.hasSmartTypingPairs = true;
+            }
+        }
+    }
+
+    QMap<ScopeSelector, PreferenceData>::const_iterator it;
+    for (it = d->data.constBegin(); it != d->data.constEnd(); ++it) {
+        d->index.insert(it.key(), d->entries.size());
+        d->entries.append(it.value());
+    }
+}
+
+ScopePreferences Preferences::find(const ScopeStack& scope) const
+{
+    ScopeStackKey key = { scope };
+    QHash<ScopeStackKey, ScopePreferences>::const_iterator it = d->cache.constFind(key);
+    if (it != d->cache.constEnd())
+        return it.value();
+
+    // Earlier selectors in the map take precedence
+    ScopePreferences preferences;
+    QMap<QString, QString> settings;
+    bool hasSmartTypingPairs = false;
+    foreach (int i, d->index.matches(ScopeSelector(scope))) {
+        const PreferenceData& entry = d->entries.at(i);
+        insertValues(settings, entry.settings, true);
+        insertValues(preferences.shellVariables, entry.shellVariables, true);
+        if (entry.hasSmartTypingPairs && !hasSmartTypingPairs) {
+            preferences.smartTypingPairs = entry.smartTypingPairs;
+            hasSmartTypingPairs = true;
+        }
+    }
+    preferences.increaseIndentPattern = d->regex(settings.value("increaseIndentPattern"));
+    preferences.decreaseIndentPattern = d->regex(settings.value("decreaseIndentPattern"));
+    preferences.unIndentedLinePattern = d->regex(settings.value("unIndentedLinePattern"));
+
+    if (d->cache.size() >= MaxCachedPreferences)
+        d->cache.clear();
+    d->cache.insert(key, preferences);
+    return preferences;
+}
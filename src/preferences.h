@@ -0,0 +1,79 @@
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+#include "regex.h"
+#include "scopeatoms.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+
+class PlistStream;
+class PreferencesPrivate;
+
+/**
+  * The contents of a preferences file in a bundle
+  */
+struct PreferenceData {
+    PreferenceData() : hasSmartTypingPairs(false) {}
+
+    // Scope selectors, separated by commas. Empty for all scopes.
+    QString scope;
+
+    // Settings with string values, like increaseIndentPattern
+    QMap<QString, QString> settings;
+
+    // Like TM_COMMENT_START, by name
+    QMap<QString, QString> shellVariables;
+
+    QList<QPair<QString, QString> > smartTypingPairs;
+    bool hasSmartTypingPairs;
+
+    /**
+      * Reads preferences from the stream, keeping only what Preferences uses
+      */
+    static PreferenceData read(PlistStream& stream);
+};
+
+/**
+  * The preferences for a scope. Each setting comes from the best matching
+  * selector that has it, in the order of ScopeSelector, like theme formats.
+  */
+struct ScopePreferences {
+    Regex increaseIndentPattern;
+    Regex decreaseIndentPattern;
+    Regex unIndentedLinePattern;
+    QMap<QString, QString> shellVariables;
+    QList<QPair<QString, QString> > smartTypingPairs;
+};
+
+/**
+  * The preferences of the bundles, by scope selector. Copies share the
+  * data, and are only used in the GUI thread.
+  */
+class Preferences
+{
+public:
+    Preferences();
+    ~Preferences();
+
+    /**
+      * Sets the preference files, in order. A file with the same selector as
+      * an earlier one replaces the settings it has.
+      */
+    void setPreferenceData(const QList<PreferenceData>& data);
+
+    /**
+      * Returns the preferences for the scope stack. The result is cached
+      * for each scope stack, and the regexes are compiled once for each
+      * pattern.
+      */
+    ScopePreferences find(const ScopeStack& scope) const;
+
+private:
+    QSharedPointer<PreferencesPrivate> d;
+};
+
+#endif // PREFERENCES_H
@@ -1,25 +1,183 @@
 #include "regex.h"
+#include "regexsyntax.h"
+#include "literalscanner.h"
+#include "nativematcher.h"
+#include "pikevm.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QVector>
+#include <QVarLengthArray>
 
 #include <oniguruma.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+QAtomicInt matchAllocations;
+QAtomicInt lastIdentity;
+
+// With more candidates than this, one pass over the target with all the
+// regexes is faster than searching for the candidates one by one
+const int MaxSeparateSearches = 8;
+
+// Enough for any sane pattern on a sane line, while a catastrophic case
+// gives up within milliseconds
+const unsigned long DefaultRetryLimit = 1000000;
+const unsigned int DefaultStackLimit = 1000000;
+}
+
+/**
+  * The match parameters shared by all searches. Searches only read them.
+  */
+class SearchLimits
+{
+public:
+    SearchLimits() : param(onig_new_match_param()) {
+        set(DefaultRetryLimit, DefaultStackLimit);
+    }
+    ~SearchLimits() { onig_free_match_param(param); }
+
+    void set(unsigned long retryLimit, unsigned int stackLimit) {
+        onig_initialize_match_param(param);
+        onig_set_retry_limit_in_match_of_match_param(param, retryLimit);
+#if ONIGURUMA_VERSION_INT >= 60905
+        onig_set_retry_limit_in_search_of_match_param(param, retryLimit);
+#endif
+        onig_set_match_stack_limit_size_of_match_param(param, stackLimit);
+    }
+
+    OnigMatchParam* param;
+};
+
+Q_GLOBAL_STATIC(SearchLimits, searchLimits)
+
+/**
+  * The engines tried for each pattern, in order, before falling back to
+  * Oniguruma
+  */
+class RegexEngines
+{
+public:
+    RegexEngines() : enabled(true) {
+        factories.append(NativeMatcher::create);
+        factories.append(PikeVM::create);
+    }
+
+    RegexEngine* create(const RegexNodePtr& root, int captureCount) const {
+        if (!enabled || !root)
+            return 0;
+        foreach (RegexEngineFactory factory, factories) {
+            if (RegexEngine* engine = factory(root, captureCount))
+                return engine;
+        }
+        return 0;
+    }
+
+    QList<RegexEngineFactory> factories;
+    bool enabled;
+};
+
+Q_GLOBAL_STATIC(RegexEngines, regexEngines)
+
 inline const OnigUChar* uc(Regex::iterator p)
 {
     return reinterpret_cast<const OnigUChar*>(p);
 }
 
+inline const OnigUChar* uc(const char* p)
+{
+    return reinterpret_cast<const OnigUChar*>(p);
+}
+
+bool isAscii(const QString& str)
+{
+    foreach (QChar c, str) {
+        if (c.unicode() >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+/**
+  * Returns the first position from p where a match can start, or stop
+  */
+inline Regex::iterator nextStart(const RegexCharSet& first, Regex::iterator p, Regex::iterator stop)
+{
+    while (p < stop && !first.contains(p->unicode()))
+        ++p;
+    return p;
+}
+
+/**
+  * Copy the text to narrow as 8-bit characters. Returns false, leaving
+  * narrow undefined, if the text is not all ASCII.
+  */
+bool narrowAscii(const QChar* text, int length, QByteArray& narrow)
+{
+    narrow.resize(length);
+    const ushort* in = reinterpret_cast<const ushort*>(text);
+    char* out = narrow.data();
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(short(0xff80));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+        __m128i high = _mm_and_si128(_mm_or_si128(a, b), mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xffff)
+            return false;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+    }
+#endif
+
+    ushort bits = 0;
+    for (; i < length; i++) {
+        bits |= in[i];
+        out[i] = char(in[i]);
+    }
+    return bits < 0x80;
+}
+
+/**
+  * True if the pattern contains the escape sequence \c
+  */
+bool containsEscape(const QString& pattern, QChar c)
+{
+    for (int i = 0; i < pattern.length() - 1; i++) {
+        if (pattern[i] == '\\') {
+            if (pattern[++i] == c)
+                return true;
+        }
+    }
+    return false;
+}
+
 class MatchPrivate
 {
     friend class Regex;
+    friend class RegexPrivate;
+    friend class RegexSet;
+    friend class RegexSetPrivate;
     friend class Match;
 
     Regex::iterator begin;
     OnigRegion* region;
+
+    // Bytes per character in the searched text, region holds byte offsets
+    int unitSize;
 };
 
 Match::Match() :
     d_ptr(new MatchPrivate)
 {
     d_func()->region = onig_region_new();
+    d_func()->unitSize = sizeof(QChar);
+    matchAllocations.ref();
 }
 
 Match::~Match()
@@ -32,6 +190,20 @@ void Match::swap(Match &other)
     d_ptr.swap(other.d_ptr);
 }
 
+void Match::clear()
+{
+    // Keep the allocated registers, onig_search() resizes as needed
+    onig_region_clear(d_func()->region);
+    d_func()->region->num_regs = 0;
+}
+
+void Match::assign(const Match& other)
+{
+    d_func()->begin = other.d_func()->begin;
+    d_func()->unitSize = other.d_func()->unitSize;
+    onig_region_copy(d_func()->region, other.d_func()->region);
+}
+
 bool Match::isEmpty() const
 {
     return d_func()->region->num_regs == 0;
@@ -49,12 +221,12 @@ bool Match::matched(int n) const
 
 int Match::pos(int n) const
 {
-    return d_func()->region->beg[n]/sizeof(QChar);
+    return d_func()->region->beg[n]/d_func()->unitSize;
 }
 
 int Match::len(int n) const
 {
-    return d_func()->region->end[n]/sizeof(QChar) - pos(n);
+    return d_func()->region->end[n]/d_func()->unitSize - pos(n);
 }
 
 QString Match::cap(int n) const
@@ -73,17 +245,134 @@ QString Match::format(const QString& fmt) const
     return result;
 }
 
+int Match::allocations()
+{
+    return matchAllocations;
+}
+
+MatchPool::MatchPool()
+{
+}
+
+MatchPool::~MatchPool()
+{
+    qDeleteAll(available);
+}
+
+Match* MatchPool::acquire()
+{
+    if (available.isEmpty())
+        return new Match;
+
+    Match* match = available.takeLast();
+    match->clear();
+    return match;
+}
+
+void MatchPool::release(Match* match)
+{
+    available.append(match);
+}
+
+class SearchTargetPrivate
+{
+public:
+    SearchTargetPrivate() : begin(0), end(0), ascii(-1), aborted(false), scanCount(0) {}
+
+    const char* narrowText() const;
+    const QVector<int>& literalPositions(const RegexSetPrivate* set) const;
+    Match& scratch() const;
+
+    Regex::iterator begin;
+    Regex::iterator end;
+
+    // The text as 8-bit characters, made when first needed. -1 until it's
+    // known whether the text is ASCII.
+    mutable int ascii;
+    mutable QByteArray narrow;
+
+    // Set when a search exceeded the limits
+    mutable bool aborted;
+
+    // Results of scanning for the literals of each set, kept for reuse when
+    // the text changes
+    struct Scan {
+        int identity;
+        QVector<int> lastStart;
+    };
+    mutable QVector<Scan> scans;
+    mutable int scanCount;
+
+    mutable QScopedPointer<Match> match;
+};
+
 class RegexPrivate
 {
 public:
-    RegexPrivate() : rx(0) {}
-    ~RegexPrivate() { onig_free(rx); }
+    RegexPrivate() : rx(0), asciiRx(0), identity(lastIdentity.fetchAndAddRelaxed(1) + 1), dependsOnSearchStart(false), hasFirstChars(false) {}
+    ~RegexPrivate() { onig_free(rx); onig_free(asciiRx); }
 
     OnigRegex rx;
+    OnigRegex asciiRx;  // For pure ASCII text, if the pattern allows
+    int identity;
     QString pattern;
     QString error;
+    bool dependsOnSearchStart;
+
+    // At least one of these is part of every match, if not empty
+    QStringList literals;
+
+    // The characters that can start a match, if known
+    bool hasFirstChars;
+    RegexCharSet firstChars;
+
+    bool skipToStart(Regex::iterator end, Regex::iterator& offset, Regex::iterator range) const;
+
+    // Replaces Oniguruma for the patterns it supports
+    QScopedPointer<RegexEngine> engine;
+
+    RegexEngine::Result searchEngine(Regex::iterator begin, Regex::iterator end, Regex::iterator offset, Regex::iterator range, Match& match) const;
 };
 
+/**
+  * Move offset to the first position up to range where a match can start.
+  * Returns false if there is none.
+  */
+bool RegexPrivate::skipToStart(Regex::iterator end, Regex::iterator& offset, Regex::iterator range) const
+{
+    // Moving the start would move \G
+    if (!hasFirstChars || dependsOnSearchStart)
+        return true;
+
+    Regex::iterator stop = qMin(range + 1, end);
+    offset = nextStart(firstChars, offset, stop);
+    return offset != stop;
+}
+
+RegexEngine::Result RegexPrivate::searchEngine(Regex::iterator begin, Regex::iterator end, Regex::iterator offset, Regex::iterator range, Match& match) const
+{
+    const int groups = engine->captureCount();
+    QVarLengthArray<int, 32> captures(2 * (groups + 1));
+
+    RegexEngine::Result result = engine->search(begin, end, offset, range, captures.data());
+    if (result == RegexEngine::Found) {
+        MatchPrivate* m = match.d_func();
+        m->begin = begin;
+        m->unitSize = sizeof(QChar);
+        onig_region_resize(m->region, 1 + groups);
+        for (int i = 0; i <= groups; i++) {
+            int from = captures[2 * i];
+            int to = captures[2 * i + 1];
+            if (from == -1)
+                onig_region_set(m->region, i, ONIG_REGION_NOTPOS, ONIG_REGION_NOTPOS);
+            else
+                onig_region_set(m->region, i, from * sizeof(QChar), to * sizeof(QChar));
+        }
+    }
+
+    return result;
+}
+
 Regex::Regex() :
     d_ptr(new RegexPrivate)
 {
@@ -94,6 +383,7 @@ Regex::Regex(const QString& pattern) :
 {
     Q_D(Regex);
     d->pattern = pattern;
+    d->dependsOnSearchStart = containsEscape(pattern, 'G');
 
     OnigErrorInfo einfo;
     int r = onig_new(&d->rx, uc(pattern.begin()), uc(pattern.end()), ONIG_OPTION_CAPTURE_GROUP, ONIG_ENCODING_UTF16_LE, ONIG_SYNTAX_DEFAULT, &einfo);
@@ -102,6 +392,22 @@ Regex::Regex(const QString& pattern) :
         QByteArray raw(ONIG_MAX_ERROR_MESSAGE_LEN, Qt::Uninitialized);
         onig_error_code_to_str(reinterpret_cast<OnigUChar*>(raw.data()), r, &einfo);
         d->error = QString(raw);
+        return;
+    }
+
+    RegexParser parser;
+    RegexNodePtr root = parser.parse(pattern);
+    regexRequiredLiterals(root, &d->literals);
+    d->hasFirstChars = regexFirstChars(root, &d->firstChars);
+    d->engine.reset(regexEngines()->create(root, parser.captureCount()));
+
+    // Most lines are pure ASCII, which a single byte encoding handles much
+    // faster. Patterns that only make sense in Unicode fail to compile here.
+    if (isAscii(pattern)) {
+        QByteArray latin = pattern.toLatin1();
+        r = onig_new(&d->asciiRx, uc(latin.constData()), uc(latin.constData() + latin.size()), ONIG_OPTION_CAPTURE_GROUP, ONIG_ENCODING_ASCII, ONIG_SYNTAX_DEFAULT, &einfo);
+        if (r != ONIG_NORMAL)
+            d->asciiRx = 0;
     }
 }
 
@@ -124,6 +430,16 @@ QString Regex::pattern() const
     return d_func()->pattern;
 }
 
+bool Regex::dependsOnSearchStart() const
+{
+    return d_func()->dependsOnSearchStart;
+}
+
+int Regex::identity() const
+{
+    return d_func()->identity;
+}
+
 bool Regex::setPattern(const QString& pattern)
 {
     Regex that(pattern);
@@ -143,9 +459,364 @@ bool Regex::search(iterator begin, iterator end, Match &match) const
 
 bool Regex::search(iterator begin, iterator end, iterator offset, iterator range, Match &match) const
 {
+    if (!d_func()->skipToStart(end, offset, range))
+        return false;
+
+    if (d_func()->engine) {
+        RegexEngine::Result result = d_func()->searchEngine(begin, end, offset, range, match);
+        if (result != RegexEngine::Unknown)
+            return result == RegexEngine::Found;
+    }
+
     MatchPrivate* m = match.d_func();
 
     m->begin = begin;
-    int r = onig_search(d_func()->rx, uc(begin), uc(end), uc(offset), uc(range), m->region, ONIG_OPTION_NONE);
-    return (r != ONIG_MISMATCH);
+    m->unitSize = sizeof(QChar);
+    int r = onig_search_with_param(d_func()->rx, uc(begin), uc(end), uc(offset), uc(range), m->region, ONIG_OPTION_NONE, searchLimits()->param);
+    return (r >= 0);
+}
+
+bool Regex::search(const SearchTarget& target, iterator offset, iterator range, Match& match) const
+{
+    Q_D(const Regex);
+    const SearchTargetPrivate* t = target.d_func();
+    if (!d->skipToStart(t->end, offset, range))
+        return false;
+
+    if (d->engine) {
+        RegexEngine::Result result = d->searchEngine(t->begin, t->end, offset, range, match);
+        if (result != RegexEngine::Unknown)
+            return result == RegexEngine::Found;
+    }
+
+    const char* narrow = d->asciiRx ? t->narrowText() : 0;
+    const int unitSize = narrow ? 1 : sizeof(QChar);
+    const OnigUChar* text = narrow ? uc(narrow) : uc(t->begin);
+
+    MatchPrivate* m = match.d_func();
+    m->begin = t->begin;
+    m->unitSize = unitSize;
+    int r = onig_search_with_param(narrow ? d->asciiRx : d->rx, text, text + (t->end - t->begin) * unitSize,
+                                   text + (offset - t->begin) * unitSize, text + (range - t->begin) * unitSize,
+                                   m->region, ONIG_OPTION_NONE, searchLimits()->param);
+    if (r < 0 && r != ONIG_MISMATCH)
+        t->aborted = true;
+    return (r >= 0);
+}
+
+void Regex::setSearchLimits(unsigned long retryLimit, unsigned int stackLimit)
+{
+    searchLimits()->set(retryLimit, stackLimit);
+}
+
+class RegexSetPrivate
+{
+public:
+    RegexSetPrivate() : identity(lastIdentity.fetchAndAddRelaxed(1) + 1), dependsOnSearchStart(false), hasFirstChars(false) {}
+    ~RegexSetPrivate();
+
+    OnigRegSet* acquire(bool ascii) const;
+    void release(OnigRegSet* set, bool ascii) const;
+
+    int searchAll(const SearchTargetPrivate* target, Regex::iterator offset, Regex::iterator range, Match& match) const;
+
+    // Keeps the compiled regexes alive, the onig sets only borrow them.
+    // The sets hold all regexes, other engines only search for them one
+    // by one.
+    QList<Regex> regexes;
+    QVector<OnigRegex> programs;
+    QVector<OnigRegex> asciiPrograms;   // Empty unless all programs have one
+    QVector<OnigMatchParam*> params;    // One per program, all the same
+    QVector<int> programIndices;        // Index of each program in regexes
+    QVector<int> indices;               // Valid regexes
+    int identity;
+    bool dependsOnSearchStart;
+
+    // Characters that can start a match of any of the regexes, if known
+    bool hasFirstChars;
+    RegexCharSet firstChars;
+
+    // Literals of regex i have id i. Regexes without literals are always
+    // searched for.
+    LiteralScanner scanner;
+    QVector<bool> filtered;
+
+    // An onig set keeps the match regions of its last search, so concurrent
+    // searches need one set each
+    mutable QMutex mutex;
+    mutable QList<OnigRegSet*> available;
+    mutable QList<OnigRegSet*> availableAscii;
+};
+
+RegexSetPrivate::~RegexSetPrivate()
+{
+    foreach (OnigRegSet* set, available + availableAscii) {
+        // Detach the borrowed regexes, onig_regset_free() would free them
+        for (int i = onig_regset_number_of_regex(set) - 1; i >= 0; i--) {
+            onig_regset_replace(set, i, 0);
+        }
+        onig_regset_free(set);
+    }
+}
+
+OnigRegSet* RegexSetPrivate::acquire(bool ascii) const
+{
+    {
+        QMutexLocker lock(&mutex);
+        QList<OnigRegSet*>& sets = ascii ? availableAscii : available;
+        if (!sets.isEmpty())
+            return sets.takeLast();
+    }
+
+    QVector<OnigRegex> regs = ascii ? asciiPrograms : programs;
+    OnigRegSet* set = 0;
+    int r = onig_regset_new(&set, regs.size(), regs.data());
+    Q_ASSERT(r == ONIG_NORMAL);
+    Q_UNUSED(r);
+    return set;
+}
+
+void RegexSetPrivate::release(OnigRegSet* set, bool ascii) const
+{
+    QMutexLocker lock(&mutex);
+    (ascii ? availableAscii : available).append(set);
+}
+
+int RegexSetPrivate::searchAll(const SearchTargetPrivate* target, Regex::iterator offset, Regex::iterator range, Match& match) const
+{
+    const char* narrow = asciiPrograms.isEmpty() ? 0 : target->narrowText();
+    const int unitSize = narrow ? 1 : sizeof(QChar);
+    const OnigUChar* text = narrow ? uc(narrow) : uc(target->begin);
+
+    OnigRegSet* set = acquire(narrow != 0);
+    int index = -1;
+    int pos;
+    int r = onig_regset_search_with_param(set, text, text + (target->end - target->begin) * unitSize,
+                                          text + (offset - target->begin) * unitSize, text + (range - target->begin) * unitSize,
+                                          ONIG_REGSET_POSITION_LEAD, ONIG_OPTION_NONE, const_cast<OnigMatchParam**>(params.constData()), &pos);
+    if (r < 0 && r != ONIG_MISMATCH)
+        target->aborted = true;
+    if (r >= 0) {
+        MatchPrivate* m = match.d_func();
+        m->begin = target->begin;
+        m->unitSize = unitSize;
+        onig_region_copy(m->region, onig_regset_get_region(set, r));
+        index = programIndices[r];
+    }
+    release(set, narrow != 0);
+    return index;
+}
+
+const char* SearchTargetPrivate::narrowText() const
+{
+    if (ascii == -1)
+        ascii = narrowAscii(begin, end - begin, narrow) ? 1 : 0;
+    return ascii ? narrow.constData() : 0;
+}
+
+const QVector<int>& SearchTargetPrivate::literalPositions(const RegexSetPrivate* set) const
+{
+    for (int i = 0; i < scanCount; i++) {
+        if (scans[i].identity == set->identity)
+            return scans[i].lastStart;
+    }
+
+    if (scanCount == scans.size())
+        scans.append(Scan());
+    Scan& scan = scans[scanCount++];
+    scan.identity = set->identity;
+    set->scanner.scan(begin, end, scan.lastStart);
+    return scan.lastStart;
+}
+
+Match& SearchTargetPrivate::scratch() const
+{
+    if (!match)
+        match.reset(new Match);
+    return *match;
+}
+
+SearchTarget::SearchTarget() :
+    d_ptr(new SearchTargetPrivate)
+{
+}
+
+SearchTarget::SearchTarget(iterator begin, iterator end) :
+    d_ptr(new SearchTargetPrivate)
+{
+    setText(begin, end);
+}
+
+SearchTarget::~SearchTarget()
+{
+}
+
+void SearchTarget::setText(iterator begin, iterator end)
+{
+    Q_D(SearchTarget);
+    d->begin = begin;
+    d->end = end;
+    d->ascii = -1;
+    d->aborted = false;
+    d->scanCount = 0;
+}
+
+SearchTarget::iterator SearchTarget::begin() const
+{
+    return d_func()->begin;
+}
+
+SearchTarget::iterator SearchTarget::end() const
+{
+    return d_func()->end;
+}
+
+bool SearchTarget::isAborted() const
+{
+    return d_func()->aborted;
+}
+
+RegexSet::RegexSet() :
+    d_ptr(new RegexSetPrivate)
+{
+}
+
+RegexSet::RegexSet(const QList<Regex>& regexes) :
+    d_ptr(new RegexSetPrivate)
+{
+    Q_D(RegexSet);
+    d->regexes = regexes;
+    d->filtered.fill(false, regexes.size());
+    d->hasFirstChars = true;
+    bool ascii = true;
+    for (int i = 0; i < regexes.size(); i++) {
+        if (regexes[i].dependsOnSearchStart())
+            d->dependsOnSearchStart = true;
+        if (regexes[i].isValid()) {
+            d->indices.append(i);
+            if (regexes[i].d_func()->hasFirstChars)
+                d->firstChars |= regexes[i].d_func()->firstChars;
+            else
+                d->hasFirstChars = false;
+
+            d->programs.append(regexes[i].d_func()->rx);
+            d->asciiPrograms.append(regexes[i].d_func()->asciiRx);
+            d->programIndices.append(i);
+            if (!regexes[i].d_func()->asciiRx)
+                ascii = false;
+
+            foreach (const QString& literal, regexes[i].d_func()->literals) {
+                d->scanner.addLiteral(literal, i);
+                d->filtered[i] = true;
+            }
+        }
+    }
+    if (!ascii)
+        d->asciiPrograms.clear();
+    d->params.fill(searchLimits()->param, d->programs.size());
+    d->scanner.build();
+}
+
+RegexSet::~RegexSet()
+{
+}
+
+int RegexSet::size() const
+{
+    return d_func()->regexes.size();
+}
+
+bool RegexSet::dependsOnSearchStart() const
+{
+    return d_func()->dependsOnSearchStart;
+}
+
+int RegexSet::identity() const
+{
+    return d_func()->identity;
+}
+
+int RegexSet::search(iterator begin, iterator end, Match& match) const
+{
+    return search(begin, end, begin, end, match);
+}
+
+int RegexSet::search(iterator begin, iterator end, iterator offset, iterator range, Match& match) const
+{
+    SearchTarget target(begin, end);
+    return search(target, offset, range, match);
+}
+
+int RegexSet::search(const SearchTarget& target, iterator offset, iterator range, Match& match) const
+{
+    Q_D(const RegexSet);
+    const SearchTargetPrivate* t = target.d_func();
+    if (d->indices.isEmpty())
+        return -1;
+
+    // No match starts before the first character that can start one. Each
+    // regex also skips ahead to its own first characters when searched for.
+    if (d->hasFirstChars && !d->dependsOnSearchStart) {
+        iterator stop = qMin(range + 1, t->end);
+        offset = nextStart(d->firstChars, offset, stop);
+        if (offset == stop)
+            return -1;
+    }
+
+    // A regex can only match from offset if one of its literals occurs
+    // somewhere after offset
+    const QVector<int>* lastStart = d->scanner.isEmpty() ? 0 : &t->literalPositions(d);
+    const int from = offset - t->begin;
+    QVarLengthArray<bool, 64> candidate(d->regexes.size());
+    int candidates = 0;
+    foreach (int i, d->indices) {
+        candidate[i] = !d->filtered[i] || lastStart->at(i) >= from;
+        if (candidate[i])
+            candidates++;
+    }
+    if (candidates == 0)
+        return -1;
+
+    // Many candidates are searched for in one pass
+    if (candidates > MaxSeparateSearches)
+        return d->searchAll(t, offset, range, match);
+
+    // A few one by one, in index order. Only a match before the best one
+    // so far can win, or at the same position with a lower index.
+    int index = -1;
+    Match& m = t->scratch();
+    foreach (int i, d->indices) {
+        if (!candidate[i])
+            continue;
+        if (index != -1 && match.pos() == from && i > index)
+            break;
+
+        iterator limit = (index == -1) ? range : t->begin + match.pos();
+        if (d->regexes[i].search(target, offset, limit, m)) {
+            if (index == -1 || m.pos() < match.pos() || (m.pos() == match.pos() && i < index)) {
+                match.swap(m);
+                index = i;
+            }
+        }
+    }
+    return index;
+}
+
+RegexEngine::~RegexEngine()
+{
+}
+
+void registerRegexEngine(RegexEngineFactory factory)
+{
+    regexEngines()->factories.append(factory);
+}
+
+void setRegexEnginesEnabled(bool enabled)
+{
+    regexEngines()->enabled = enabled;
+}
+
+bool regexEnginesEnabled()
+{
+    return regexEngines()->enabled;
 }
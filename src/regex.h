@@ -2,11 +2,15 @@
 #define REGEX_H
 
 #include <QString>
+#include <QList>
 #include <QScopedPointer>
 #include <QSharedPointer>
 
 class MatchPrivate;
 class RegexPrivate;
+class RegexSetPrivate;
+class SearchTargetPrivate;
+class SearchTarget;
 
 /**
   * Provides information about a successful search result.
@@ -30,6 +34,17 @@ public:
       */
     void swap(Match& other);
 
+    /**
+      * Make this instance empty again, like a newly created one. The
+      * allocated region is kept for reuse.
+      */
+    void clear();
+
+    /**
+      * Make this a copy of other, reusing the allocated region.
+      */
+    void assign(const Match& other);
+
     /**
       * Returns true if size() is 0
       */
@@ -71,14 +86,52 @@ public:
      */
     QString format(const QString& fmt) const;
 
+    /**
+      * Returns the number of match regions allocated so far, by all
+      * instances. Intended for checking that hot loops reuse their matches.
+      */
+    static int allocations();
+
 private:
     friend class Regex;
+    friend class RegexPrivate;
+    friend class RegexSet;
+    friend class RegexSetPrivate;
 
     Q_DISABLE_COPY(Match)
     Q_DECLARE_PRIVATE(Match)
     QScopedPointer<MatchPrivate> d_ptr;
 };
 
+/**
+  * Keeps Match instances for reuse, so that code searching in a loop doesn't
+  * allocate new regions for every step.
+  */
+class MatchPool
+{
+public:
+    MatchPool();
+
+    /**
+      * Destruction. All acquired matches must have been released.
+      */
+    ~MatchPool();
+
+    /**
+      * Returns an empty match, which is owned by the pool until released.
+      */
+    Match* acquire();
+
+    /**
+      * Give back a match returned by acquire()
+      */
+    void release(Match* match);
+
+private:
+    Q_DISABLE_COPY(MatchPool)
+    QList<Match*> available;
+};
+
 /**
   * Represents a compiled regular expression.
   */
@@ -124,6 +177,18 @@ public:
       */
     QString pattern() const;
 
+    /**
+      * Returns true if the pattern uses \G. Results for such patterns
+      * depend on where the search starts, and not only on the target.
+      */
+    bool dependsOnSearchStart() const;
+
+    /**
+      * Returns a number that identifies the compiled regex. Copies share the
+      * identity of the original, and numbers are never reused.
+      */
+    int identity() const;
+
     /**
       * Returns isValid()
       */
@@ -144,6 +209,7 @@ public:
       *
       * If found, the results are stored in match, and the function returns
       * true. If not found, the function returns false, and match is undefined.
+      * A search that exceeds the search limits also returns false.
       *
       * The expression must be found within the boundaries of offset and range,
       * which must be a subregion of begin and end. The outer region, begin and
@@ -152,9 +218,158 @@ public:
       */
     bool search(iterator begin, iterator end, iterator offset, iterator range, Match& match) const;
 
+    /**
+      * Like search(target.begin(), target.end(), offset, range, match).
+      *
+      * If the target is pure ASCII, it's searched as 8-bit text, unless the
+      * pattern can't be compiled for that.
+      *
+      * If the search exceeds the search limits, the target is marked as
+      * aborted.
+      */
+    bool search(const SearchTarget& target, iterator offset, iterator range, Match& match) const;
+
+    /**
+      * Limit the work done by each search, for all regexes. A retry is one
+      * step of backtracking, the stack limit is the number of entries on the
+      * backtracking stack. A search that exceeds a limit gives up, and finds
+      * nothing. 0 means unlimited.
+      *
+      * Must not be called while any search is running.
+      */
+    static void setSearchLimits(unsigned long retryLimit, unsigned int stackLimit);
+
 private:
+    friend class RegexSet;
+
     Q_DECLARE_PRIVATE(Regex)
     QSharedPointer<RegexPrivate> d_ptr;
 };
 
+/**
+  * The text of a sequence of searches, such as the line being highlighted.
+  *
+  * What is learned about the text by one search is kept for the next ones,
+  * until the text is changed. A target must only be used by one thread at a
+  * time, and the text must stay valid while it's being searched.
+  */
+class SearchTarget
+{
+public:
+    typedef Regex::iterator iterator;
+
+    /**
+      * Create a target with empty text
+      */
+    SearchTarget();
+
+    /**
+      * Create a target for the text between begin and end
+      */
+    SearchTarget(iterator begin, iterator end);
+
+    /**
+      * Destruction
+      */
+    ~SearchTarget();
+
+    /**
+      * Replace the text, and forget everything known about the old one
+      */
+    void setText(iterator begin, iterator end);
+
+    iterator begin() const;
+    iterator end() const;
+
+    /**
+      * Returns true if a search of the current text gave up because it
+      * exceeded the search limits, see Regex::setSearchLimits(). Results of
+      * such searches are incomplete.
+      */
+    bool isAborted() const;
+
+private:
+    friend class Regex;
+    friend class RegexSet;
+
+    Q_DISABLE_COPY(SearchTarget)
+    Q_DECLARE_PRIVATE(SearchTarget)
+    QScopedPointer<SearchTargetPrivate> d_ptr;
+};
+
+/**
+  * A list of regular expressions that are searched for together, in a single
+  * pass over the target.
+  *
+  * Literal strings that must be part of any match are extracted from each
+  * pattern. Regexes with such strings are only searched for when one of the
+  * strings occurs in the target after the search offset.
+  */
+class RegexSet
+{
+public:
+    typedef Regex::iterator iterator;
+
+    /**
+      * Create an empty set
+      */
+    RegexSet();
+
+    /**
+      * Create a set of the given regexes. The compiled regexes are shared,
+      * not copied. Invalid regexes keep their index, but never match.
+      */
+    RegexSet(const QList<Regex>& regexes);
+
+    /**
+      * Destruction
+      */
+    ~RegexSet();
+
+    /**
+      * Returns the number of regexes in the set, including invalid ones
+      */
+    int size() const;
+
+    /**
+      * Returns true if any of the regexes depends on the search start, see
+      * Regex::dependsOnSearchStart()
+      */
+    bool dependsOnSearchStart() const;
+
+    /**
+      * Returns a number that identifies the set, like Regex::identity()
+      */
+    int identity() const;
+
+    /**
+      * Shortcut for search(begin, end, begin, end, match)
+      */
+    int search(iterator begin, iterator end, Match& match) const;
+
+    /**
+      * Search for all the regexes within the given boundaries, see
+      * Regex::search().
+      *
+      * Returns the index of the regex with the leftmost match, and stores the
+      * result in match. If several regexes match at the same position, the
+      * one with the lowest index wins. If none of them match, the function
+      * returns -1, and match is undefined.
+      *
+      * Searching is thread safe.
+      */
+    int search(iterator begin, iterator end, iterator offset, iterator range, Match& match) const;
+
+    /**
+      * Like search(target.begin(), target.end(), offset, range, match), but
+      * the target is scanned for the literal strings only once for any
+      * number of searches.
+      */
+    int search(const SearchTarget& target, iterator offset, iterator range, Match& match) const;
+
+private:
+    Q_DECLARE_PRIVATE(RegexSet)
+    QSharedPointer<RegexSetPrivate> d_ptr;
+};
+
 #endif // REGEX_H
@@ -0,0 +1,66 @@
+#ifndef REGEXENGINE_H
+#define REGEXENGINE_H
+
+#include "regexsyntax.h"
+
+#include <QtCore/QChar>
+
+/**
+  * A regex engine that can be used by Regex instead of Oniguruma.
+  *
+  * Engines are created from the parsed pattern, and only for the patterns
+  * they support. Oniguruma compiles every pattern anyway, and is used when
+  * no engine supports the pattern, and when an engine can't decide about a
+  * particular text.
+  */
+class RegexEngine
+{
+public:
+    enum Result {
+        NotFound,
+        Found,
+        Unknown         // The text has something only Oniguruma can decide on
+    };
+
+    virtual ~RegexEngine();
+
+    /**
+      * Returns a short name of the engine, for diagnostics
+      */
+    virtual const char* name() const = 0;
+
+    /**
+      * Returns the number of capture groups
+      */
+    virtual int captureCount() const = 0;
+
+    /**
+      * Search like Regex::search(). If found, the start and end of the match
+      * and each capture group are stored in captures, relative to begin,
+      * using -1 for groups that didn't participate. There is room for
+      * 2 * (captureCount() + 1) values.
+      */
+    virtual Result search(const QChar* begin, const QChar* end, const QChar* offset, const QChar* range,
+                          int* captures) const = 0;
+};
+
+/**
+  * Creates an engine for a parsed pattern, or returns 0 if the engine
+  * doesn't support it
+  */
+typedef RegexEngine* (*RegexEngineFactory)(const RegexNodePtr& root, int captureCount);
+
+/**
+  * Add an engine for patterns compiled from now on. Engines are tried in
+  * the order they were registered, after the built-in ones. Not thread safe.
+  */
+void registerRegexEngine(RegexEngineFactory factory);
+
+/**
+  * Use the registered engines for patterns compiled from now on, or only
+  * Oniguruma. They are enabled by default. Not thread safe.
+  */
+void setRegexEnginesEnabled(bool enabled);
+bool regexEnginesEnabled();
+
+#endif // REGEXENGINE_H
@@ -0,0 +1,1058 @@
+#include "regexsyntax.h"
+
+#include <QtCore/QChar>
+
+namespace {
+const int MaxRepeat = 100000;
+const int MaxLiterals = 64;
+
+/**
+  * The ranges of characters in the BMP that case fold to more than one
+  * character, from the full case folding of Unicode
+  */
+const ushort MultiCharFolds[][2] = {
+    {0x00df, 0x00df}, {0x0130, 0x0130}, {0x0149, 0x0149}, {0x01f0, 0x01f0},
+    {0x0390, 0x0390}, {0x03b0, 0x03b0}, {0x0587, 0x0587}, {0x1e96, 0x1e9a},
+    {0x1e9e, 0x1e9e}, {0x1f50, 0x1f50}, {0x1f52, 0x1f52}, {0x1f54, 0x1f54},
+    {0x1f56, 0x1f56}, {0x1f80, 0x1faf}, {0x1fb2, 0x1fb4}, {0x1fb6, 0x1fb7},
+    {0x1fbc, 0x1fbc}, {0x1fc2, 0x1fc4}, {0x1fc6, 0x1fc7}, {0x1fcc, 0x1fcc},
+    {0x1fd2, 0x1fd3}, {0x1fd6, 0x1fd7}, {0x1fe2, 0x1fe4}, {0x1fe6, 0x1fe7},
+    {0x1ff2, 0x1ff4}, {0x1ff6, 0x1ff7}, {0x1ffc, 0x1ffc}, {0xfb00, 0xfb06},
+    {0xfb13, 0xfb17}
+};
+
+bool hasMultiCharFold(ushort first, ushort last)
+{
+    const int count = sizeof(MultiCharFolds) / sizeof(MultiCharFolds[0]);
+    for (int i = 0; i < count; i++) {
+        if (first <= MultiCharFolds[i][1] && last >= MultiCharFolds[i][0])
+            return true;
+    }
+    return false;
+}
+
+/**
+  * Strings of which at least one must be part of any match
+  */
+struct Literals {
+    Literals() : known(false) {}
+
+    bool known;
+    QStringList strings;
+
+    int minLength() const {
+        int length = -1;
+        foreach (const QString& s, strings) {
+            if (length == -1 || s.length() < length)
+                length = s.length();
+        }
+        return length;
+    }
+
+    // Longer strings are less likely to occur by accident, and fewer of them
+    // make scanning cheaper
+    bool isBetterThan(const Literals& other) const {
+        if (!other.known)
+            return known;
+        if (!known)
+            return false;
+        int length = minLength();
+        int otherLength = other.minLength();
+        if (length != otherLength)
+            return length > otherLength;
+        return strings.size() < other.strings.size();
+    }
+};
+
+Literals requiredLiterals(const RegexNodePtr& node);
+
+void takeRun(QString& run, Literals& result)
+{
+    if (!run.isEmpty()) {
+        Literals literals;
+        literals.known = true;
+        literals.strings << run;
+        if (literals.isBetterThan(result))
+            result = literals;
+        run.clear();
+    }
+}
+
+Literals requiredLiterals(const RegexNodePtr& node)
+{
+    Literals result;
+    switch (node->type) {
+    case RegexNode::Char:
+        if (!node->caseInsensitive) {
+            result.known = true;
+            result.strings << QString(QChar(node->ch));
+        }
+        break;
+    case RegexNode::Group:
+    case RegexNode::Atomic:
+        result = requiredLiterals(node->children[0]);
+        break;
+    case RegexNode::Repeat:
+        if (node->min > 0)
+            result = requiredLiterals(node->children[0]);
+        break;
+    case RegexNode::Alternation:
+        result.known = true;
+        foreach (const RegexNodePtr& child, node->children) {
+            Literals literals = requiredLiterals(child);
+            if (!literals.known)
+                return Literals();
+            foreach (const QString& s, literals.strings) {
+                if (!result.strings.contains(s))
+                    result.strings << s;
+            }
+            if (result.strings.size() > MaxLiterals)
+                return Literals();
+        }
+        break;
+    case RegexNode::Concat:
+        {
+            // Consecutive characters form one string. Zero width nodes
+            // don't consume anything, so they don't break the string.
+            QString run;
+            foreach (const RegexNodePtr& child, node->children) {
+                if (child->type == RegexNode::Char && !child->caseInsensitive) {
+                    run += QChar(child->ch);
+                } else if (child->type == RegexNode::Assertion || child->type == RegexNode::LookAround) {
+                    continue;
+                } else {
+                    takeRun(run, result);
+                    Literals literals = requiredLiterals(child);
+                    if (literals.isBetterThan(result))
+                        result = literals;
+                }
+            }
+            takeRun(run, result);
+        }
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+/**
+  * Case folding relates some characters from 128 to 255 with ones beyond,
+  * like the micro sign and mu. Those are not worth telling apart.
+  */
+void insertCaseFoldings(RegexCharSet* first)
+{
+    for (ushort c = 128; c < 256; c++)
+        first->insert(c);
+    first->other = true;
+}
+
+/**
+  * Stores the units that can start a match of node in first, and returns
+  * true if node can match the empty string
+  */
+bool firstChars(const RegexNodePtr& node, RegexCharSet* first)
+{
+    switch (node->type) {
+    case RegexNode::Empty:
+    case RegexNode::Assertion:
+    case RegexNode::LookAround:
+        return true;
+    case RegexNode::Char:
+        // Any character of the folded string may start a match
+        if (node->hasMultiCharFolds()) {
+            first->fill();
+            return false;
+        }
+        first->insert(node->ch);
+        if (node->caseInsensitive) {
+            first->insert(QChar(node->ch).toLower().unicode());
+            first->insert(QChar(node->ch).toUpper().unicode());
+            insertCaseFoldings(first);
+        }
+        return false;
+    case RegexNode::Class:
+    case RegexNode::Any:
+        if (node->hasMultiCharFolds()) {
+            first->fill();
+            return false;
+        }
+        for (ushort c = 0; c < 256; c++) {
+            if (node->matches(c))
+                first->insert(c);
+        }
+        if (node->caseInsensitive)
+            insertCaseFoldings(first);
+        first->other = true;
+        if (node->type == RegexNode::Class && !node->opaque && !node->negated && !node->classFlags && !node->caseInsensitive) {
+            first->other = false;
+            for (int i = 0; i < node->ranges.size(); i++) {
+                if (node->ranges[i].second >= 256)
+                    first->other = true;
+            }
+        }
+        return false;
+    case RegexNode::Group:
+    case RegexNode::Atomic:
+        return firstChars(node->children[0], first);
+    case RegexNode::Repeat:
+        return firstChars(node->children[0], first) || node->min == 0;
+    case RegexNode::Concat:
+        foreach (const RegexNodePtr& child, node->children) {
+            if (!firstChars(child, first))
+                return false;
+        }
+        return true;
+    case RegexNode::Alternation:
+        {
+            bool empty = false;
+            foreach (const RegexNodePtr& child, node->children) {
+                if (firstChars(child, first))
+                    empty = true;
+            }
+            return empty;
+        }
+    default:
+        first->fill();
+        return true;
+    }
+}
+
+bool isHexDigit(ushort c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+int hexValue(ushort c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return c - 'A' + 10;
+}
+}
+
+RegexNode::RegexNode(Type type) :
+    type(type), ch(0), caseInsensitive(false), classFlags(0), negated(false),
+    opaque(false), dotAll(false), assertion(LineStart), capture(0), min(0),
+    max(0), greedy(true), ahead(true), negative(false)
+{
+}
+
+bool RegexNode::matches(ushort c) const
+{
+    if (type == Any)
+        return dotAll || c != '\n';
+    if (type == Char)
+        return c == ch || (caseInsensitive && QChar(c).toCaseFolded() == QChar(ch).toCaseFolded());
+
+    Q_ASSERT(type == Class);
+    if (opaque)
+        return true;
+
+    bool found = false;
+    for (int i = 0; i < ranges.size() && !found; i++) {
+        if (c >= ranges[i].first && c <= ranges[i].second) {
+            found = true;
+        } else if (caseInsensitive) {
+            ushort lower = QChar(c).toLower().unicode();
+            ushort upper = QChar(c).toUpper().unicode();
+            found = (lower >= ranges[i].first && lower <= ranges[i].second)
+                    || (upper >= ranges[i].first && upper <= ranges[i].second);
+        }
+    }
+    if (!found && classFlags) {
+        bool word = regexIsWordChar(c);
+        bool digit = QChar(c).category() == QChar::Number_DecimalDigit;
+        bool space = regexIsSpace(c);
+        bool hex = isHexDigit(c);
+        found = ((classFlags & Word) && word) || ((classFlags & NotWord) && !word)
+                || ((classFlags & Digit) && digit) || ((classFlags & NotDigit) && !digit)
+                || ((classFlags & Space) && space) || ((classFlags & NotSpace) && !space)
+                || ((classFlags & HexDigit) && hex) || ((classFlags & NotHexDigit) && !hex);
+    }
+    return negated ? !found : found;
+}
+
+bool RegexNode::hasMultiCharFolds() const
+{
+    if (!caseInsensitive)
+        return false;
+    if (type == Char)
+        return hasMultiCharFold(ch, ch);
+    if (type != Class || negated)
+        return false;
+    if (opaque)
+        return true;
+    for (int i = 0; i < ranges.size(); i++) {
+        if (hasMultiCharFold(ranges[i].first, ranges[i].second))
+            return true;
+    }
+    return false;
+}
+
+RegexParser::RegexParser() :
+    pos(0), failed(false), captures(0),
+    caseInsensitive(false), dotAll(false), extended(false)
+{
+}
+
+RegexNodePtr RegexParser::parse(const QString& pattern)
+{
+    this->pattern = pattern;
+    pos = 0;
+    failed = false;
+    captures = 0;
+    caseInsensitive = false;
+    dotAll = false;
+    extended = false;
+
+    RegexNodePtr node = parseAlternation();
+    if (failed || pos != pattern.length())
+        return RegexNodePtr();
+    return node;
+}
+
+int RegexParser::captureCount() const
+{
+    return captures;
+}
+
+RegexNodePtr RegexParser::parseAlternation()
+{
+    QList<RegexNodePtr> alternatives;
+    alternatives << parseConcat();
+    while (!failed && pos < pattern.length() && pattern[pos] == '|') {
+        pos++;
+        alternatives << parseConcat();
+    }
+    if (failed)
+        return RegexNodePtr();
+    if (alternatives.size() == 1)
+        return alternatives.first();
+
+    RegexNodePtr node(new RegexNode(RegexNode::Alternation));
+    node->children = alternatives;
+    return node;
+}
+
+RegexNodePtr RegexParser::parseConcat()
+{
+    QList<RegexNodePtr> items;
+    while (true) {
+        skipExtended();
+        if (pos >= pattern.length() || pattern[pos] == '|' || pattern[pos] == ')')
+            break;
+
+        RegexNodePtr atom = parseAtom();
+        if (failed)
+            return RegexNodePtr();
+        if (!atom)
+            continue; // Comment, or options for the rest of the group
+
+        atom = parseQuantifier(atom);
+        if (failed)
+            return RegexNodePtr();
+        items << atom;
+    }
+
+    if (items.isEmpty())
+        return RegexNodePtr(new RegexNode(RegexNode::Empty));
+    if (items.size() == 1)
+        return items.first();
+
+    RegexNodePtr node(new RegexNode(RegexNode::Concat));
+    node->children = items;
+    return node;
+}
+
+RegexNodePtr RegexParser::parseQuantifier(RegexNodePtr atom)
+{
+    while (true) {
+        skipExtended();
+        if (pos >= pattern.length())
+            return atom;
+
+        QChar c = pattern[pos];
+        int min;
+        int max;
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            pos++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            pos++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            pos++;
+        } else if (c == '{') {
+            if (!parseInterval(&min, &max))
+                return atom; // A literal brace, handled by parseAtom()
+        } else {
+            return atom;
+        }
+
+        if (failed || atom->type == RegexNode::Assertion || atom->type == RegexNode::Empty) {
+            failed = true;
+            return RegexNodePtr();
+        }
+
+        RegexNodePtr repeat(new RegexNode(RegexNode::Repeat));
+        repeat->min = min;
+        repeat->max = max;
+        repeat->children << atom;
+        atom = repeat;
+
+        if (pos < pattern.length()) {
+            if (pattern[pos] == '?') {
+                // {n}? means either reluctant or optional, depending on
+                // the syntax
+                if (c == '{' && min == max) {
+                    failed = true;
+                    return RegexNodePtr();
+                }
+                repeat->greedy = false;
+                pos++;
+            } else if (pattern[pos] == '+' && c != '{') {
+                // Possessive, {n,m}+ is a repeated interval in this syntax
+                atom = RegexNodePtr(new RegexNode(RegexNode::Atomic));
+                atom->children << repeat;
+                pos++;
+            }
+        }
+    }
+}
+
+bool RegexParser::parseInterval(int* min, int* max)
+{
+    Q_ASSERT(pattern[pos] == '{');
+    int p = pos + 1;
+    int lower = -1;
+    int upper = -1;
+    while (p < pattern.length() && pattern[p].isDigit() && pattern[p].unicode() < 128) {
+        lower = qMax(lower, 0) * 10 + pattern[p].digitValue();
+        if (lower > MaxRepeat)
+            return false;
+        p++;
+    }
+    if (p < pattern.length() && pattern[p] == ',') {
+        p++;
+        while (p < pattern.length() && pattern[p].isDigit() && pattern[p].unicode() < 128) {
+            upper = qMax(upper, 0) * 10 + pattern[p].digitValue();
+            if (upper > MaxRepeat)
+                return false;
+            p++;
+        }
+        if (lower == -1 && upper == -1)
+            return false;
+    } else {
+        if (lower == -1)
+            return false;
+        upper = lower;
+    }
+    if (p >= pattern.length() || pattern[p] != '}')
+        return false;
+
+    *min = qMax(lower, 0);
+    *max = upper;
+    if (upper != -1 && upper < *min) {
+        failed = true;
+        return false;
+    }
+    pos = p + 1;
+    return true;
+}
+
+RegexNodePtr RegexParser::parseAtom()
+{
+    QChar c = pattern[pos];
+    if (c == '(')
+        return parseGroup();
+    if (c == '[')
+        return parseClass();
+    if (c == '\\')
+        return parseEscape();
+
+    if (c == '*' || c == '+' || c == '?') {
+        failed = true; // Nothing to repeat
+        return RegexNodePtr();
+    }
+    if (c == '{') {
+        int save = pos;
+        int min;
+        int max;
+        if (parseInterval(&min, &max) || failed) {
+            pos = save;
+            failed = true;
+            return RegexNodePtr();
+        }
+    }
+
+    pos++;
+    if (c == '.') {
+        RegexNodePtr node(new RegexNode(RegexNode::Any));
+        node->dotAll = dotAll;
+        return node;
+    }
+    if (c == '^' || c == '$') {
+        RegexNodePtr node(new RegexNode(RegexNode::Assertion));
+        node->assertion = (c == '^') ? RegexNode::LineStart : RegexNode::LineEnd;
+        return node;
+    }
+    if (c.isHighSurrogate() && pos < pattern.length() && pattern[pos].isLowSurrogate()) {
+        uint high = c.unicode();
+        uint low = pattern[pos++].unicode();
+        return makeChar(0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00));
+    }
+    return makeChar(c.unicode());
+}
+
+RegexNodePtr RegexParser::parseGroup()
+{
+    Q_ASSERT(pattern[pos] == '(');
+    pos++;
+
+    RegexNodePtr node;
+    bool isolatedOptions = false;
+    bool savedCaseInsensitive = caseInsensitive;
+    bool savedDotAll = dotAll;
+    bool savedExtended = extended;
+
+    if (pos < pattern.length() && pattern[pos] == '?') {
+        pos++;
+        if (pos >= pattern.length()) {
+            failed = true;
+            return RegexNodePtr();
+        }
+        QChar c = pattern[pos];
+        if (c == ':') {
+            pos++;
+            node = RegexNodePtr(new RegexNode(RegexNode::Group));
+        } else if (c == '=' || c == '!') {
+            pos++;
+            node = RegexNodePtr(new RegexNode(RegexNode::LookAround));
+            node->negative = (c == '!');
+        } else if (c == '>') {
+            pos++;
+            node = RegexNodePtr(new RegexNode(RegexNode::Atomic));
+        } else if (c == '#') {
+            while (pos < pattern.length() && pattern[pos] != ')')
+                pos++;
+            if (pos >= pattern.length())
+                failed = true;
+            pos++;
+            return RegexNodePtr();
+        } else if (c == '<' && pos + 1 < pattern.length() && (pattern[pos + 1] == '=' || pattern[pos + 1] == '!')) {
+            node = RegexNodePtr(new RegexNode(RegexNode::LookAround));
+            node->ahead = false;
+            node->negative = (pattern[pos + 1] == '!');
+            pos += 2;
+        } else if (c == '<' || c == '\'') {
+            QChar close = (c == '<') ? QChar('>') : QChar('\'');
+            int end = pattern.indexOf(close, pos + 1);
+            if (end <= pos + 1) {
+                failed = true;
+                return RegexNodePtr();
+            }
+            pos = end + 1;
+            node = RegexNodePtr(new RegexNode(RegexNode::Group));
+            node->capture = ++captures;
+        } else {
+            bool i = caseInsensitive;
+            bool m = dotAll;
+            bool x = extended;
+            if (!parseOptions(&i, &m, &x)) {
+                failed = true;
+                return RegexNodePtr();
+            }
+            caseInsensitive = i;
+            dotAll = m;
+            extended = x;
+            node = RegexNodePtr(new RegexNode(RegexNode::Group));
+            if (pattern[pos] == ')') {
+                // The options apply to the rest of the enclosing group, which
+                // makes a group of its own: ab(?i)c|d is ab(?i:c|d)
+                pos++;
+                isolatedOptions = true;
+            } else {
+                pos++; // ':'
+            }
+        }
+    } else {
+        node = RegexNodePtr(new RegexNode(RegexNode::Group));
+        node->capture = ++captures;
+    }
+
+    if (isolatedOptions) {
+        // The enclosing group restores the options
+        RegexNodePtr child = parseAlternation();
+        if (failed)
+            return RegexNodePtr();
+        node->children << child;
+        return node;
+    }
+
+    RegexNodePtr child = parseAlternation();
+    caseInsensitive = savedCaseInsensitive;
+    dotAll = savedDotAll;
+    extended = savedExtended;
+    if (failed || pos >= pattern.length() || pattern[pos] != ')') {
+        failed = true;
+        return RegexNodePtr();
+    }
+    pos++;
+    node->children << child;
+    return node;
+}
+
+bool RegexParser::parseOptions(bool* i, bool* m, bool* x)
+{
+    bool on = true;
+    while (pos < pattern.length()) {
+        QChar c = pattern[pos];
+        if (c == ')' || c == ':')
+            return true;
+        if (c == '-' && on) {
+            on = false;
+        } else if (c == 'i') {
+            *i = on;
+        } else if (c == 'm') {
+            *m = on;
+        } else if (c == 'x') {
+            *x = on;
+        } else {
+            return false;
+        }
+        pos++;
+    }
+    return false;
+}
+
+RegexNodePtr RegexParser::parseEscape()
+{
+    Q_ASSERT(pattern[pos] == '\\');
+    pos++;
+    if (pos >= pattern.length()) {
+        failed = true;
+        return RegexNodePtr();
+    }
+
+    ushort c = pattern[pos++].unicode();
+    RegexNodePtr node;
+    switch (c) {
+    case 'w': case 'W': case 'd': case 'D': case 's': case 'S': case 'h': case 'H':
+        node = RegexNodePtr(new RegexNode(RegexNode::Class));
+        pos--;
+        parseClassEscape(node, &c);
+        return node;
+    case 'p': case 'P':
+        node = RegexNodePtr(new RegexNode(RegexNode::Class));
+        pos--;
+        parseClassEscape(node, &c);
+        if (failed)
+            return RegexNodePtr();
+        return node;
+    case 'b': case 'B': case 'A': case 'z': case 'Z': case 'G':
+        node = RegexNodePtr(new RegexNode(RegexNode::Assertion));
+        switch (c) {
+        case 'b': node->assertion = RegexNode::WordBoundary; break;
+        case 'B': node->assertion = RegexNode::NotWordBoundary; break;
+        case 'A': node->assertion = RegexNode::TextStart; break;
+        case 'z': node->assertion = RegexNode::TextEnd; break;
+        case 'Z': node->assertion = RegexNode::TextEndOrNewline; break;
+        default: node->assertion = RegexNode::SearchStart; break;
+        }
+        return node;
+    case 'k':
+        if (pos < pattern.length() && (pattern[pos] == '<' || pattern[pos] == '\'')) {
+            QChar close = (pattern[pos] == '<') ? QChar('>') : QChar('\'');
+            int end = pattern.indexOf(close, pos + 1);
+            if (end <= pos + 1) {
+                failed = true;
+                return RegexNodePtr();
+            }
+            pos = end + 1;
+            return RegexNodePtr(new RegexNode(RegexNode::Backreference));
+        }
+        return makeChar(c);
+    case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        while (pos < pattern.length() && pattern[pos].unicode() >= '0' && pattern[pos].unicode() <= '9')
+            pos++;
+        return RegexNodePtr(new RegexNode(RegexNode::Backreference));
+    case 'K': case 'R': case 'X': case 'N': case 'O': case 'y': case 'Y': case 'g': case 'C': case 'M':
+        failed = true;
+        return RegexNodePtr();
+    case 'x':
+        if (pos < pattern.length() && pattern[pos] == '{') {
+            // May be beyond the BMP, which a class can't hold
+            uint value;
+            pos++;
+            if (!parseHex(8, &value) || value > 0x10ffff || pos >= pattern.length() || pattern[pos] != '}') {
+                failed = true;
+                return RegexNodePtr();
+            }
+            pos++;
+            return makeChar(value);
+        }
+        // Fall through
+    default:
+        {
+            pos--;
+            RegexNodePtr dummy(new RegexNode(RegexNode::Class));
+            ushort value;
+            if (!parseClassEscape(dummy, &value) || failed || dummy->opaque) {
+                failed = true;
+                return RegexNodePtr();
+            }
+            return makeChar(value);
+        }
+    }
+}
+
+bool RegexParser::parseClassEscape(RegexNodePtr node, ushort* c)
+{
+    if (pos >= pattern.length()) {
+        failed = true;
+        return false;
+    }
+
+    ushort e = pattern[pos++].unicode();
+    switch (e) {
+    case 'w': node->classFlags |= RegexNode::Word; return false;
+    case 'W': node->classFlags |= RegexNode::NotWord; return false;
+    case 'd': node->classFlags |= RegexNode::Digit; return false;
+    case 'D': node->classFlags |= RegexNode::NotDigit; return false;
+    case 's': node->classFlags |= RegexNode::Space; return false;
+    case 'S': node->classFlags |= RegexNode::NotSpace; return false;
+    case 'h': node->classFlags |= RegexNode::HexDigit; return false;
+    case 'H': node->classFlags |= RegexNode::NotHexDigit; return false;
+    case 'p': case 'P':
+        node->opaque = true;
+        if (pos < pattern.length() && pattern[pos] == '{') {
+            int end = pattern.indexOf('}', pos);
+            if (end == -1) {
+                failed = true;
+                return false;
+            }
+            pos = end + 1;
+        } else {
+            failed = true;
+        }
+        return false;
+    case 't': *c = '\t'; return true;
+    case 'n': *c = '\n'; return true;
+    case 'r': *c = '\r'; return true;
+    case 'f': *c = '\f'; return true;
+    case 'v': *c = '\v'; return true;
+    case 'a': *c = 0x07; return true;
+    case 'e': *c = 0x1b; return true;
+    case 'b': *c = 0x08; return true;
+    case 'x':
+    case 'u':
+        {
+            uint value = 0;
+            bool ok;
+            if (e == 'x' && pos < pattern.length() && pattern[pos] == '{') {
+                pos++;
+                ok = parseHex(8, &value) && pos < pattern.length() && pattern[pos] == '}';
+                pos++;
+            } else {
+                int digits = (e == 'x') ? 2 : 4;
+                int start = pos;
+                ok = parseHex(digits, &value) && (e == 'x' || pos - start == 4);
+            }
+            if (!ok || value > 0x10ffff) {
+                failed = true;
+                return false;
+            }
+            if (value > 0xffff) {
+                node->opaque = true; // Needs a surrogate pair
+                return false;
+            }
+            *c = value;
+            return true;
+        }
+    case '0':
+        {
+            uint value = 0;
+            for (int i = 0; i < 2 && pos < pattern.length(); i++) {
+                ushort d = pattern[pos].unicode();
+                if (d < '0' || d > '7')
+                    break;
+                value = value * 8 + (d - '0');
+                pos++;
+            }
+            *c = value;
+            return true;
+        }
+    case 'c':
+        if (pos >= pattern.length()) {
+            failed = true;
+            return false;
+        }
+        *c = pattern[pos++].unicode() & 0x1f;
+        return true;
+    case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+    case 'k': case 'g': case 'K': case 'R': case 'X': case 'N': case 'O': case 'C': case 'M':
+        node->opaque = true;
+        return false;
+    default:
+        if (QChar(e).isHighSurrogate()) {
+            node->opaque = true;
+            if (pos < pattern.length() && pattern[pos].isLowSurrogate())
+                pos++;
+            return false;
+        }
+        *c = e;
+        return true;
+    }
+}
+
+bool RegexParser::parseHex(int maxDigits, uint* value)
+{
+    int digits = 0;
+    *value = 0;
+    while (digits < maxDigits && pos < pattern.length() && isHexDigit(pattern[pos].unicode())) {
+        *value = *value * 16 + hexValue(pattern[pos].unicode());
+        pos++;
+        digits++;
+    }
+    return digits > 0;
+}
+
+RegexNodePtr RegexParser::parseClass()
+{
+    Q_ASSERT(pattern[pos] == '[');
+    pos++;
+
+    RegexNodePtr node(new RegexNode(RegexNode::Class));
+    node->caseInsensitive = caseInsensitive;
+    if (pos < pattern.length() && pattern[pos] == '^') {
+        node->negated = true;
+        pos++;
+    }
+
+    bool first = true;
+    while (true) {
+        if (pos >= pattern.length()) {
+            failed = true;
+            return RegexNodePtr();
+        }
+
+        QChar c = pattern[pos];
+        if (c == ']' && !first) {
+            pos++;
+            break;
+        }
+        first = false;
+
+        if (c == '[') {
+            // POSIX brackets and nested classes are not evaluated here
+            node->opaque = true;
+            if (pattern.mid(pos, 2) == "[:") {
+                int end = pattern.indexOf(":]", pos + 2);
+                if (end != -1) {
+                    pos = end + 2;
+                    continue;
+                }
+            }
+            if (!parseClass())
+                return RegexNodePtr();
+            continue;
+        }
+        if (c == '&' && pos + 1 < pattern.length() && pattern[pos + 1] == '&') {
+            node->opaque = true;
+            pos += 2;
+            continue;
+        }
+
+        ushort low;
+        if (c == '\\') {
+            pos++;
+            if (!parseClassEscape(node, &low)) {
+                if (failed)
+                    return RegexNodePtr();
+                continue;
+            }
+        } else {
+            low = c.unicode();
+            pos++;
+        }
+        if (QChar(low).isHighSurrogate() || QChar(low).isLowSurrogate()) {
+            node->opaque = true;
+            continue;
+        }
+
+        if (pos + 1 < pattern.length() && pattern[pos] == '-' && pattern[pos + 1] != ']' && pattern[pos + 1] != '[') {
+            int save = pos;
+            pos++;
+            ushort high;
+            bool isChar;
+            if (pattern[pos] == '\\') {
+                pos++;
+                RegexNodePtr probe(new RegexNode(RegexNode::Class));
+                isChar = parseClassEscape(probe, &high);
+                if (failed)
+                    return RegexNodePtr();
+                if (!isChar) {
+                    // Like a-\w, the dash is literal
+                    pos = save + 1;
+                    node->ranges << qMakePair(low, low) << qMakePair(ushort('-'), ushort('-'));
+                    continue;
+                }
+            } else {
+                high = pattern[pos++].unicode();
+            }
+            if (high < low) {
+                failed = true;
+                return RegexNodePtr();
+            }
+            if (high >= 0xd800 && low <= 0xdfff) {
+                // Ranges reaching into surrogates match pairs in Oniguruma
+                node->opaque = true;
+            }
+            node->ranges << qMakePair(low, high);
+            continue;
+        }
+
+        node->ranges << qMakePair(low, low);
+    }
+    return node;
+}
+
+void RegexParser::skipExtended()
+{
+    if (!extended)
+        return;
+
+    while (pos < pattern.length()) {
+        if (pattern[pos].isSpace()) {
+            pos++;
+        } else if (pattern[pos] == '#') {
+            while (pos < pattern.length() && pattern[pos] != '\n')
+                pos++;
+        } else {
+            break;
+        }
+    }
+}
+
+RegexNodePtr RegexParser::makeChar(uint c)
+{
+    if (c > 0xffff) {
+        // A surrogate pair, grouped so that quantifiers apply to both halves
+        RegexNodePtr pair(new RegexNode(RegexNode::Concat));
+        pair->children << makeChar(0xd800 + ((c - 0x10000) >> 10));
+        pair->children << makeChar(0xdc00 + ((c - 0x10000) & 0x3ff));
+        RegexNodePtr group(new RegexNode(RegexNode::Group));
+        group->children << pair;
+        return group;
+    }
+
+    RegexNodePtr node(new RegexNode(RegexNode::Char));
+    node->ch = c;
+    node->caseInsensitive = caseInsensitive && (QChar(c).toLower() != QChar(c).toUpper() || hasMultiCharFold(c, c));
+    return node;
+}
+
+RegexCharSet::RegexCharSet() :
+    other(false)
+{
+    for (int i = 0; i < 8; i++)
+        bits[i] = 0;
+}
+
+void RegexCharSet::insert(ushort c)
+{
+    if (c < 256)
+        bits[c >> 5] |= 1u << (c & 31);
+    else
+        other = true;
+}
+
+void RegexCharSet::fill()
+{
+    for (int i = 0; i < 8; i++)
+        bits[i] = ~0u;
+    other = true;
+}
+
+bool RegexCharSet::isFull() const
+{
+    for (int i = 0; i < 8; i++) {
+        if (bits[i] != ~0u)
+            return false;
+    }
+    return other;
+}
+
+RegexCharSet& RegexCharSet::operator|=(const RegexCharSet& set)
+{
+    for (int i = 0; i < 8; i++)
+        bits[i] |= set.bits[i];
+    other = other || set.other;
+    return *this;
+}
+
+bool regexFirstChars(const RegexNodePtr& node, RegexCharSet* first)
+{
+    if (!node)
+        return false;
+
+    *first = RegexCharSet();
+    if (firstChars(node, first))
+        return false;
+    return !first->isFull();
+}
+
+bool regexRequiredLiterals(const RegexNodePtr& node, QStringList* literals)
+{
+    if (!node)
+        return false;
+
+    Literals result = requiredLiterals(node);
+    if (!result.known)
+        return false;
+    *literals = result.strings;
+    return true;
+}
+
+bool regexIsWordChar(ushort c)
+{
+    if (c < 128) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+    switch (QChar(c).category()) {
+    case QChar::Letter_Uppercase:
+    case QChar::Letter_Lowercase:
+    case QChar::Letter_Titlecase:
+    case QChar::Letter_Modifier:
+    case QChar::Letter_Other:
+    case QChar::Mark_NonSpacing:
+    case QChar::Mark_SpacingCombining:
+    case QChar::Mark_Enclosing:
+    case QChar::Number_DecimalDigit:
+    case QChar::Punctuation_Connector:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool regexIsSpace(ushort c)
+{
+    // The White_Space property
+    if (c <= 0x20)
+        return c == 0x20 || (c >= 0x09 && c <= 0x0d);
+    switch (c) {
+    case 0x85: case 0xa0: case 0x1680: case 0x2028: case 0x2029:
+    case 0x202f: case 0x205f: case 0x3000:
+        return true;
+    default:
+        return c >= 0x2000 && c <= 0x200a;
+    }
+}
@@ -0,0 +1,195 @@
+#ifndef REGEXSYNTAX_H
+#define REGEXSYNTAX_H
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+
+struct RegexNode;
+typedef QSharedPointer<RegexNode> RegexNodePtr;
+
+/**
+  * A node in the syntax tree of a parsed regular expression.
+  *
+  * The tree is used to analyze patterns, never to match them directly.
+  */
+struct RegexNode {
+    enum Type {
+        Empty,          // Matches the empty string
+        Char,           // A single code unit, ch
+        Class,          // A set of code units, [...], \w, and so on
+        Any,            // .
+        Assertion,      // A zero width assertion, ^, $, \b, and so on
+        Group,          // Group around children[0], capturing if capture > 0
+        Concat,         // All children in sequence
+        Alternation,    // One of the children, the first one that matches
+        Repeat,         // children[0] repeated min to max times (max -1 is unbounded)
+        Backreference,  // \1, \k<name>
+        LookAround,     // (?=...), (?!...), (?<=...), (?<!...)
+        Atomic          // (?>...), and possessive quantifiers
+    };
+
+    enum AssertionType {
+        LineStart,      // ^
+        LineEnd,        // $
+        WordBoundary,   // \b
+        NotWordBoundary,// \B
+        TextStart,      // \A
+        TextEnd,        // \z
+        TextEndOrNewline,// \Z
+        SearchStart     // \G
+    };
+
+    enum ClassFlag {
+        Word = 0x1,
+        NotWord = 0x2,
+        Digit = 0x4,
+        NotDigit = 0x8,
+        Space = 0x10,
+        NotSpace = 0x20,
+        HexDigit = 0x40,
+        NotHexDigit = 0x80
+    };
+
+    explicit RegexNode(Type type = Empty);
+
+    Type type;
+
+    // Char
+    ushort ch;
+
+    // Char, Class
+    bool caseInsensitive;
+
+    // Class
+    QList<QPair<ushort, ushort> > ranges;
+    int classFlags;
+    bool negated;
+    bool opaque;        // Contains something that can't be evaluated here, like \p{...}
+
+    // Any
+    bool dotAll;
+
+    // Assertion
+    AssertionType assertion;
+
+    // Group
+    int capture;
+
+    // Repeat
+    int min;
+    int max;
+    bool greedy;
+
+    // LookAround
+    bool ahead;
+    bool negative;
+
+    QList<RegexNodePtr> children;
+
+    /**
+      * Returns true if the code unit is matched by a Char, Class or Any
+      * node. Opaque classes are assumed to match anything.
+      */
+    bool matches(ushort c) const;
+
+    /**
+      * Returns true if the Char or Class node ignores case and contains a
+      * character that folds to several, like U+00DF to "ss". Oniguruma
+      * matches those against the whole string, which matches() can't tell.
+      */
+    bool hasMultiCharFolds() const;
+};
+
+/**
+  * Parses Oniguruma's default (Ruby) pattern syntax into a tree of
+  * RegexNode.
+  *
+  * Only the constructs used by TextMate grammars are understood. For
+  * anything else, parse() returns a null pointer, and callers must assume
+  * nothing about the pattern.
+  */
+class RegexParser
+{
+public:
+    RegexParser();
+
+    RegexNodePtr parse(const QString& pattern);
+
+    /**
+      * Returns the number of capture groups found by the last parse()
+      */
+    int captureCount() const;
+
+private:
+    RegexNodePtr parseAlternation();
+    RegexNodePtr parseConcat();
+    RegexNodePtr parseQuantifier(RegexNodePtr atom);
+    RegexNodePtr parseAtom();
+    RegexNodePtr parseGroup();
+    RegexNodePtr parseEscape();
+    RegexNodePtr parseClass();
+    bool parseClassEscape(RegexNodePtr node, ushort* c);
+    bool parseOptions(bool* i, bool* m, bool* x);
+    bool parseInterval(int* min, int* max);
+    bool parseHex(int maxDigits, uint* value);
+    void skipExtended();
+    RegexNodePtr makeChar(uint c);
+
+    QString pattern;
+    int pos;
+    bool failed;
+    int captures;
+
+    bool caseInsensitive;
+    bool dotAll;
+    bool extended;
+};
+
+/**
+  * A set of code units. Units from 256 up are not told apart, they are all
+  * in the set or none of them.
+  */
+struct RegexCharSet {
+    RegexCharSet();
+
+    bool contains(ushort c) const {
+        return c < 256 ? (bits[c >> 5] >> (c & 31)) & 1 : other;
+    }
+
+    void insert(ushort c);
+    void fill();
+    bool isFull() const;
+
+    RegexCharSet& operator|=(const RegexCharSet& other);
+
+    uint bits[8];
+    bool other;
+};
+
+/**
+  * Stores the code units that can start a match of node in first. Returns
+  * false if that is not known, or if node can match the empty string, which
+  * means that a match can start anywhere.
+  */
+bool regexFirstChars(const RegexNodePtr& node, RegexCharSet* first);
+
+/**
+  * Returns true if any match of node contains at least one of the strings
+  * stored in literals. False if no such list is known.
+  */
+bool regexRequiredLiterals(const RegexNodePtr& node, QStringList* literals);
+
+/**
+  * Returns true if the code unit is a word character, like \w
+  */
+bool regexIsWordChar(ushort c);
+
+/**
+  * Returns true if the code unit is a space character, like \s
+  */
+bool regexIsSpace(ushort c);
+
+#endif // REGEXSYNTAX_H
@@ -3,27 +3,105 @@
 
 #include "grammar.h"
 #include "regex.h"
+#include "scopeatoms.h"
+#include "syntaxdata.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QVector>
 
 /** @internal */
 
+/**
+  * A range of entries in one of the index arrays of GrammarData
+  */
+struct RuleSpan {
+    RuleSpan() : start(0), count(0) {}
+
+    qint32 start;
+    qint32 count;
+};
+
 struct RuleData {
-    RuleData() {}
+    RuleData() : name(0), contentName(0), include(NoRule), endHasBackReferences(false),
+        compiled(false), resolved(false), hasSearchSet(false) {}
 
-    QString name;
-    QString contentName;
-    QString includeName;
-    QString beginPattern;
+    ScopeAtom name;
+    ScopeAtom contentName;
+
+    RuleId include;
+    QString beginPattern;   // Null if there is none
     QString endPattern;
     QString matchPattern;
     Regex begin;
+    Regex end;
     Regex match;
-    QMap<int, RulePtr> captures;
-    QMap<int, RulePtr> beginCaptures;
-    QMap<int, RulePtr> endCaptures;
-    QList<RulePtr> patterns;
-    WeakRulePtr include;
+    bool endHasBackReferences;
+
+    // Capture rules by group number, in GrammarData::captureRules
+    RuleSpan captures;
+    RuleSpan beginCaptures;
+    RuleSpan endCaptures;
+
+    // Child rules, in GrammarData::children
+    RuleSpan patterns;
+
+    // The regexes are compiled, and the includes among the child rules
+    // resolved, on first use
+    bool compiled;
+    bool resolved;
+
+    // The leaf rules searched for when this rule is the current context, in
+    // order, and their begin or match regexes combined. Built on first use
+    // by Grammar::resolveChildRules().
+    bool hasSearchSet;
+    RuleSpan searchRules;   // In GrammarData::searchRules
+    RegexSet searchSet;
+};
+
+/**
+  * A compiled grammar. Rules refer to each other by index into rules, and
+  * lists of rules are spans of the index arrays.
+  *
+  * Rules are made when first reached from the root rule, and their regexes
+  * compiled when first searched for, so the table grows while it's used.
+  * The table is shared by all highlighters using the grammar. Reading it
+  * requires lock for reading, and making rules requires it for writing.
+  */
+struct GrammarData {
+    GrammarData() : root(NoRule), regexCount(0) {}
+
+    QReadWriteLock lock;
+
+    QVector<RuleData> rules;
+    QVector<RuleId> captureRules;   // NoRule for groups without a rule
+    QVector<RuleId> children;
+    QVector<RuleId> searchRules;
+    RuleId root;
+
+    // Number of regexes used by the rules compiled so far. The number of
+    // rules made so far is the size of rules.
+    int regexCount;
+
+    // Where rules not made yet come from
+    struct Include {
+        QString name;
+        RuleId self;        // Root of the grammar the include is in
+    };
+    QHash<RuleId, Include> includes;                    // Not resolved yet
+    QMap<QString, RuleId> grammars;                     // Roots by scope name
+    QHash<RuleId, QMap<QString, SyntaxRule> > repositoryData; // Not made yet, by grammar root
+    QHash<RuleId, QMap<QString, RuleId> > repositories; // By grammar root
+
+    /**
+      * Returns the rule for capture group in a capture table, or NoRule
+      */
+    RuleId captureRule(const RuleSpan& captures, int group) const {
+        return group < captures.count ? captureRules.at(captures.start + group) : NoRule;
+    }
 
-    QMap<QString, RulePtr> referenced;
+private:
+    Q_DISABLE_COPY(GrammarData)
 };
 
 #endif // RULEDATA_H
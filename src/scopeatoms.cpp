@@ -0,0 +1,82 @@
+#include "scopeatoms.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+
+namespace {
+
+struct ScopeAtomTable {
+    ScopeAtomTable() {
+        ids.insert(QString(), 0);
+        names.append(QString());
+        segments.append(QVector<ScopeAtom>());
+    }
+
+    QReadWriteLock lock;
+    QHash<QString, ScopeAtom> ids;
+    QVector<QString> names;
+    QVector<QVector<ScopeAtom> > segments;
+
+    // Requires lock for writing
+    ScopeAtom add(const QString& name) {
+        QHash<QString, ScopeAtom>::const_iterator it = ids.constFind(name);
+        if (it != ids.constEnd())
+            return it.value();
+
+        const ScopeAtom atom = names.size();
+        ids.insert(name, atom);
+        names.append(name);
+        segments.append(QVector<ScopeAtom>());
+
+        QVector<ScopeAtom> parts;
+        if (name.contains('.')) {
+            foreach (const QString& segment, name.split('.'))
+                parts.append(add(segment));
+        } else {
+            parts.append(atom);
+        }
+        segments[atom] = parts;
+        return atom;
+    }
+};
+
+Q_GLOBAL_STATIC(ScopeAtomTable, scopeAtomTable)
+
+}
+
+ScopeAtom ScopeAtoms::intern(const QString& name)
+{
+    ScopeAtomTable* table = scopeAtomTable();
+    {
+        QReadLocker locker(&table->lock);
+        QHash<QString, ScopeAtom>::const_iterator it = table->ids.constFind(name);
+        if (it != table->ids.constEnd())
+            return it.value();
+    }
+    QWriteLocker locker(&table->lock);
+    return table->add(name);
+}
+
+QString ScopeAtoms::name(ScopeAtom atom)
+{
+    ScopeAtomTable* table = scopeAtomTable();
+    QReadLocker locker(&table->lock);
+    return table->names.value(atom);
+}
+
+QVector<ScopeAtom> ScopeAtoms::segments(ScopeAtom atom)
+{
+    ScopeAtomTable* table = scopeAtomTable();
+    QReadLocker locker(&table->lock);
+    return table->segments.value(atom);
+}
+
+QStringList ScopeAtoms::names(const ScopeStack& scope)
+{
+    ScopeAtomTable* table = scopeAtomTable();
+    QReadLocker locker(&table->lock);
+    QStringList names;
+    foreach (ScopeAtom atom, scope)
+        names.append(table->names.value(atom));
+    return names;
+}
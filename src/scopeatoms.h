@@ -0,0 +1,66 @@
+#ifndef SCOPEATOMS_H
+#define SCOPEATOMS_H
+
+#include <QtCore/QStack>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+/**
+  * A scope name, or a dot separated segment of one, interned as an index
+  * into a table shared by all grammars and themes. 0 is the empty name.
+  */
+typedef qint32 ScopeAtom;
+
+/**
+  * The scope names of a position, outermost first
+  */
+typedef QStack<ScopeAtom> ScopeStack;
+
+/**
+  * A scope stack as a hash key, for results cached by scope. Copying it only
+  * shares the stack.
+  */
+struct ScopeStackKey {
+    ScopeStack scope;
+};
+
+inline bool operator==(const ScopeStackKey& lhs, const ScopeStackKey& rhs)
+{
+    return lhs.scope == rhs.scope;
+}
+
+inline uint qHash(const ScopeStackKey& key)
+{
+    uint h = 0;
+    foreach (ScopeAtom element, key.scope)
+        h = (h << 4) ^ (h >> 28) ^ uint(element);
+    return h;
+}
+
+/**
+  * The table of scope atoms. Atoms are never removed, so they can be kept
+  * anywhere. All functions are thread safe.
+  */
+class ScopeAtoms
+{
+public:
+    /**
+      * Returns the atom for name, adding it if it's new
+      */
+    static ScopeAtom intern(const QString& name);
+
+    static QString name(ScopeAtom atom);
+
+    /**
+      * Returns the atoms of the dot separated segments of the scope name,
+      * "string.quoted" => "string", "quoted"
+      */
+    static QVector<ScopeAtom> segments(ScopeAtom atom);
+
+    /**
+      * Returns the names of the scopes on the stack, for display
+      */
+    static QStringList names(const ScopeStack& scope);
+};
+
+#endif // SCOPEATOMS_H
@@ -1,12 +1,12 @@
 #include "scopeselector.h"
 
-ScopeSelector::ScopeSelector(const QStack<QString>& other)
+#include <QtCore/QtAlgorithms>
+
+ScopeSelector::ScopeSelector(const ScopeStack& other)
 {
-    QVectorIterator<QString> it(other);
-    while (it.hasNext()) {
-        QString element = it.next();
-        if (!element.isEmpty()) {
-            push(element.split("."));
+    foreach (ScopeAtom element, other) {
+        if (element != 0) {
+            push(ScopeAtoms::segments(element));
         }
     }
 }
@@ -18,19 +18,19 @@ ScopeSelector::ScopeSelector(const QString& selector)
 
     QStringListIterator it(selector.simplified().split(" "));
     while (it.hasNext()) {
-        push(it.next().split("."));
+        push(ScopeAtoms::segments(ScopeAtoms::intern(it.next())));
     }
 }
 
-bool ScopeSelector::matches(const ScopeSelector& scope)
+bool ScopeSelector::matches(const ScopeSelector& scope) const
 {
     int l = scope.size();
     for (int i = 0; i < size(); i++) {
-        const QStringList& s = at(size() - 1 - i);
+        const QVector<ScopeAtom>& s = at(size() - 1 - i);
         while (true) {
             if (l == 0)
                 return false;
-            const QStringList& x = scope[--l];
+            const QVector<ScopeAtom>& x = scope[--l];
             if (listComparePrefix(x, s))
                 break;
         }
@@ -49,8 +49,8 @@ bool operator<(const ScopeSelector& lhs, const ScopeSelector& rhs)
             return false;
         if (i >= rhs.size())
             return true;
-        QStringList l = lhs[lhs.size() - 1 - i];
-        QStringList r = rhs[rhs.size() - 1 - i];
+        const QVector<ScopeAtom>& l = lhs[lhs.size() - 1 - i];
+        const QVector<ScopeAtom>& r = rhs[rhs.size() - 1 - i];
         if (l != r) {
             int sz = qMax(l.size(), r.size());
             for (int j = 0; j < sz; j++) {
@@ -58,8 +58,9 @@ bool operator<(const ScopeSelector& lhs, const ScopeSelector& rhs)
                     return false;
                 if (j >= r.size())
                     return true;
+                // Ordered by name, atoms are in the order they were seen
                 if (l[j] != r[j])
-                    return l[j] < r[j];
+                    return ScopeAtoms::name(l[j]) < ScopeAtoms::name(r[j]);
             }
             Q_ASSERT(false);
         }
@@ -67,14 +68,70 @@ bool operator<(const ScopeSelector& lhs, const ScopeSelector& rhs)
     return false;
 }
 
-bool listComparePrefix(const QStringList& list, const QStringList& prefix)
+bool listComparePrefix(const QVector<ScopeAtom>& list, const QVector<ScopeAtom>& prefix)
 {
-    if (list.length() < prefix.length())
+    if (list.size() < prefix.size())
         return false;
 
-    for (int i = 0; i < prefix.length(); i++) {
+    for (int i = 0; i < prefix.size(); i++) {
         if (list[i] != prefix[i])
             return false;
     }
     return true;
 }
+
+ScopeSelectorIndex::ScopeSelectorIndex() :
+    nodes(1)
+{
+}
+
+void ScopeSelectorIndex::clear()
+{
+    nodes = QVector<Node>(1);
+    selectors.clear();
+    values.clear();
+}
+
+void ScopeSelectorIndex::insert(const ScopeSelector& selector, int value)
+{
+    int node = 0;
+    if (!selector.isEmpty()) {
+        foreach (ScopeAtom segment, selector.top()) {
+            int child = nodes.at(node).children.value(segment, -1);
+            if (child == -1) {
+                child = nodes.size();
+                nodes[node].children.insert(segment, child);
+                nodes.append(Node());
+            }
+            node = child;
+        }
+    }
+    nodes[node].selectors.append(selectors.size());
+    selectors.append(selector);
+    values.append(value);
+}
+
+QVector<int> ScopeSelectorIndex::matches(const ScopeSelector& scope) const
+{
+    QVector<int> candidates = nodes.at(0).selectors;
+    foreach (const QVector<ScopeAtom>& element, scope) {
+        int node = 0;
+        foreach (ScopeAtom segment, element) {
+            node = nodes.at(node).children.value(segment, -1);
+            if (node == -1)
+                break;
+            candidates += nodes.at(node).selectors;
+        }
+    }
+
+    // A selector is found once for each scope it's a prefix of
+    qSort(candidates.begin(), candidates.end());
+    QVector<int> result;
+    int last = -1;
+    foreach (int selector, candidates) {
+        if (selector != last && selectors.at(selector).matches(scope))
+            result.append(values.at(selector));
+        last = selector;
+    }
+    return result;
+}
@@ -1,21 +1,65 @@
 #ifndef SCOPESELECTOR_H
 #define SCOPESELECTOR_H
 
+#include "scopeatoms.h"
+
+#include <QtCore/QHash>
 #include <QtCore/QStack>
-#include <QtCore/QStringList>
+#include <QtCore/QVector>
 
 
-class ScopeSelector : public QStack<QStringList>
+/**
+  * A stack of scopes, each one as the atoms of its segments
+  */
+class ScopeSelector : public QStack<QVector<ScopeAtom> >
 {
 public:
-    ScopeSelector(const QStack<QString>& other);
+    ScopeSelector(const ScopeStack& other);
 
     ScopeSelector(const QString& selector);
 
-    bool matches(const ScopeSelector& scope);
+    bool matches(const ScopeSelector& scope) const;
+};
+
+/**
+  * Selectors compiled into a trie over the segments of their innermost
+  * scope. A selector can only match a scope stack if its innermost scope
+  * is a prefix of one of the scopes on the stack, so only the selectors
+  * found walking the trie with each of them are tried.
+  */
+class ScopeSelectorIndex
+{
+public:
+    ScopeSelectorIndex();
+
+    void clear();
+
+    /**
+      * Adds a selector, identified by value
+      */
+    void insert(const ScopeSelector& selector, int value);
+
+    /**
+      * Returns the values of the selectors that match scope, in the order
+      * the selectors were inserted
+      */
+    QVector<int> matches(const ScopeSelector& scope) const;
+
+    int size() const { return selectors.size(); }
+
+private:
+    struct Node {
+        QHash<ScopeAtom, int> children;     // Indexes into nodes
+        QVector<int> selectors;             // Indexes into selectors
+    };
+
+    // nodes[0] is the root, with the empty selectors that match anything
+    QVector<Node> nodes;
+    QVector<ScopeSelector> selectors;
+    QVector<int> values;
 };
 
 bool operator<(const ScopeSelector& lhs, const ScopeSelector& rhs);
-bool listComparePrefix(const QStringList& list, const QStringList& prefix);
+bool listComparePrefix(const QVector<ScopeAtom>& list, const QVector<ScopeAtom>& prefix);
 
 #endif // SCOPESELECTOR_H
@@ -0,0 +1,47 @@
+#-------------------------------------------------
+#
+# The editor's highlighting, bundle and regex code, shared by textlite
+# and the tools
+#
+#-------------------------------------------------
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += $$PWD/editor.cpp \
+    $$PWD/highlighter.cpp \
+    $$PWD/plistreader.cpp \
+    $$PWD/bundlemanager.cpp \
+    $$PWD/regex.cpp \
+    $$PWD/theme.cpp \
+    $$PWD/scopeselector.cpp \
+    $$PWD/scopeatoms.cpp \
+    $$PWD/grammar.cpp \
+    $$PWD/regexsyntax.cpp \
+    $$PWD/literalscanner.cpp \
+    $$PWD/nativematcher.cpp \
+    $$PWD/pikevm.cpp \
+    $$PWD/bundlecache.cpp \
+    $$PWD/syntaxdata.cpp \
+    $$PWD/preferences.cpp
+
+HEADERS += $$PWD/editor.h \
+    $$PWD/highlighter.h \
+    $$PWD/plistreader.h \
+    $$PWD/bundlemanager.h \
+    $$PWD/regex.h \
+    $$PWD/theme.h \
+    $$PWD/scopeselector.h \
+    $$PWD/scopeatoms.h \
+    $$PWD/grammar.h \
+    $$PWD/ruledata.h \
+    $$PWD/regexsyntax.h \
+    $$PWD/literalscanner.h \
+    $$PWD/nativematcher.h \
+    $$PWD/regexengine.h \
+    $$PWD/pikevm.h \
+    $$PWD/bundlecache.h \
+    $$PWD/syntaxdata.h \
+    $$PWD/preferences.h
+
+unix|win32: LIBS += -lonig
@@ -13,32 +13,15 @@ TEMPLATE = app
 SOURCES += main.cpp\
         mainwindow.cpp \
     navigator.cpp \
-    window.cpp \
-    editor.cpp \
-    highlighter.cpp \
-    plistreader.cpp \
-    bundlemanager.cpp \
-    regex.cpp \
-    theme.cpp \
-    scopeselector.cpp \
-    grammar.cpp
+    window.cpp
 
 HEADERS  += mainwindow.h \
     navigator.h \
-    window.h \
-    editor.h \
-    highlighter.h \
-    plistreader.h \
-    bundlemanager.h \
-    regex.h \
-    theme.h \
-    scopeselector.h \
-    grammar.h \
-    ruledata.h
+    window.h
 
 FORMS +=
 
-unix|win32: LIBS += -lonig
+include(src.pri)
 
 
 
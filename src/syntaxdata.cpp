@@ -0,0 +1,151 @@
+#include "syntaxdata.h"
+#include "plistreader.h"
+
+namespace {
+
+void skipValue(PlistStream& stream, PlistStream::Type type)
+{
+    if (type == PlistStream::Array || type == PlistStream::Dict)
+        stream.skip();
+}
+
+/**
+  * Returns the value as a string, which is not null even if it's empty,
+  * since it was given
+  */
+QString readString(PlistStream& stream, PlistStream::Type type)
+{
+    QString text;
+    if (type == PlistStream::String)
+        text = stream.text();
+    else if (type == PlistStream::Integer)
+        text = QString::number(stream.integer());
+    else
+        skipValue(stream, type);
+    return text.isNull() ? QString("") : text;
+}
+
+SyntaxRule readRule(PlistStream& stream, PlistStream::Type type);
+
+QList<SyntaxRule> readRuleList(PlistStream& stream, PlistStream::Type type)
+{
+    QList<SyntaxRule> rules;
+    if (type != PlistStream::Array) {
+        skipValue(stream, type);
+        return rules;
+    }
+    while ((type = stream.next()) != PlistStream::End)
+        rules.append(readRule(stream, type));
+    return rules;
+}
+
+QMap<int, SyntaxRule> readCaptures(PlistStream& stream, PlistStream::Type type)
+{
+    QMap<int, SyntaxRule> captures;
+    if (type != PlistStream::Dict) {
+        skipValue(stream, type);
+        return captures;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        int group = stream.key().toInt();
+        SyntaxRule rule = readRule(stream, type);
+        if (group >= 0)
+            captures.insert(group, rule);
+    }
+    return captures;
+}
+
+SyntaxRule readRule(PlistStream& stream, PlistStream::Type type)
+{
+    SyntaxRule rule;
+    if (type != PlistStream::Dict) {
+        skipValue(stream, type);
+        return rule;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        const QString key = stream.key();
+        if (key == "name") {
+            rule.name = readString(stream, type);
+        } else if (key == "contentName") {
+            rule.contentName = readString(stream, type);
+        } else if (key == "include") {
+            rule.include = readString(stream, type);
+        } else if (key == "begin") {
+            rule.begin = readString(stream, type);
+        } else if (key == "end") {
+            rule.end = readString(stream, type);
+        } else if (key == "match") {
+            rule.match = readString(stream, type);
+        } else if (key == "patterns") {
+            rule.patterns = readRuleList(stream, type);
+        } else if (key == "captures") {
+            rule.captures = readCaptures(stream, type);
+        } else if (key == "beginCaptures") {
+            rule.beginCaptures = readCaptures(stream, type);
+            rule.hasBeginCaptures = true;
+        } else if (key == "endCaptures") {
+            rule.endCaptures = readCaptures(stream, type);
+            rule.hasEndCaptures = true;
+        } else {
+            skipValue(stream, type);
+        }
+    }
+    return rule;
+}
+
+}
+
+SyntaxData SyntaxData::read(PlistStream& stream)
+{
+    SyntaxData syntax;
+    PlistStream::Type type = stream.next();
+    if (type != PlistStream::Dict) {
+        skipValue(stream, type);
+        return syntax;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        const QString key = stream.key();
+        if (key == "scopeName") {
+            syntax.scopeName = readString(stream, type);
+        } else if (key == "fileTypes" && type == PlistStream::Array) {
+            while ((type = stream.next()) != PlistStream::End)
+                syntax.fileTypes.append(readString(stream, type));
+        } else if (key == "patterns") {
+            syntax.patterns = readRuleList(stream, type);
+        } else if (key == "repository" && type == PlistStream::Dict) {
+            while ((type = stream.next()) != PlistStream::End) {
+                const QString name = stream.key();
+                syntax.repository.insert(name, readRule(stream, type));
+            }
+        } else {
+            skipValue(stream, type);
+        }
+    }
+    return syntax;
+}
+
+SyntaxData SyntaxData::readHeader(PlistStream& stream)
+{
+    SyntaxData syntax;
+    bool hasFileTypes = false;
+    PlistStream::Type type = stream.next();
+    if (type != PlistStream::Dict) {
+        skipValue(stream, type);
+        return syntax;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        const QString key = stream.key();
+        if (key == "scopeName") {
+            syntax.scopeName = readString(stream, type);
+        } else if (key == "fileTypes" && type == PlistStream::Array) {
+            while ((type = stream.next()) != PlistStream::End)
+                syntax.fileTypes.append(readString(stream, type));
+            hasFileTypes = true;
+        } else {
+            skipValue(stream, type);
+        }
+        if (!syntax.scopeName.isNull() && hasFileTypes)
+            break;
+    }
+    return syntax;
+}
@@ -0,0 +1,57 @@
+#ifndef SYNTAXDATA_H
+#define SYNTAXDATA_H
+
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+class PlistStream;
+
+/**
+  * A rule as written in a grammar file, before it's compiled by Grammar
+  */
+struct SyntaxRule {
+    SyntaxRule() : hasBeginCaptures(false), hasEndCaptures(false) {}
+
+    // Patterns and names are null if they are not given
+    QString name;
+    QString contentName;
+    QString include;
+    QString begin;
+    QString end;
+    QString match;
+
+    QList<SyntaxRule> patterns;
+
+    // Rules by capture group number. The begin and end captures are the
+    // same as captures if they are not given.
+    QMap<int, SyntaxRule> captures;
+    QMap<int, SyntaxRule> beginCaptures;
+    QMap<int, SyntaxRule> endCaptures;
+    bool hasBeginCaptures;
+    bool hasEndCaptures;
+};
+
+/**
+  * The contents of a grammar file
+  */
+struct SyntaxData {
+    QString scopeName;
+    QStringList fileTypes;
+    QList<SyntaxRule> patterns;
+    QMap<QString, SyntaxRule> repository;
+
+    /**
+      * Reads a grammar from the stream, keeping only what Grammar uses
+      */
+    static SyntaxData read(PlistStream& stream);
+
+    /**
+      * Reads only the scope name and file types, for the index of grammars,
+      * stopping as soon as both are found
+      */
+    static SyntaxData readHeader(PlistStream& stream);
+};
+
+#endif // SYNTAXDATA_H
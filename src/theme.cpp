@@ -1,19 +1,172 @@
 #include "theme.h"
 #include "scopeselector.h"
+#include "plistreader.h"
 
+#include <QtCore/QHash>
 #include <QtGui/QTextCharFormat>
 
 #include <QtDebug>
 
+namespace {
+
+// Formats are cached for this many scope stacks, then the cache starts over
+const int MaxCachedFormats = 4096;
+
+}
+
 class ThemePrivate
 {
     friend class Theme;
 
+public:
+    ThemePrivate() : hits(0), misses(0) {}
+
+private:
     QMap<ScopeSelector, QTextCharFormat> data;
 
-    QColor parseThemeColor(const QString& hex);
+    // The selectors of data, by their position in it
+    ScopeSelectorIndex index;
+    QVector<QTextCharFormat> formats;
+
+    // Merged formats of the scope stacks seen so far. Themes are only used
+    // by highlighters, in the GUI thread, so there's no lock.
+    QHash<ScopeStackKey, QTextCharFormat> formatCache;
+    int hits;
+    int misses;
 };
 
+namespace {
+
+QColor parseThemeColor(const QString& hex)
+{
+    QRegExp exp("#([\\w\\d]{6})([\\w\\d]{2})");
+    if (exp.exactMatch(hex)) {
+        bool ok = false;
+        QString rgbahex = exp.cap(2) + exp.cap(1);
+        QRgb rgba = rgbahex.toUInt(&ok, 16);
+        if (ok) {
+            return QColor::fromRgba(rgba);
+        }
+    }
+    return QColor(hex);
+}
+
+QTextCharFormat readFormat(PlistStream& stream, PlistStream::Type type)
+{
+    QTextCharFormat format;
+    if (type != PlistStream::Dict) {
+        stream.readValue(type);
+        return format;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        QString key = stream.key();
+        QVariant value = stream.readValue(type);
+        if (key == "foreground") {
+            QString hex = value.toString();
+            format.setForeground(parseThemeColor(hex));
+        } else if (key == "background") {
+            QString hex = value.toString();
+            format.setBackground(parseThemeColor(hex));
+        } else if (key == "fontStyle") {
+            QString styles = value.toString();
+            QStringList list = styles.split(" ", QString::SkipEmptyParts);
+            foreach (const QString& style, list) {
+                if (style == "bold") {
+                    format.setFontWeight(75);
+                } else if (style == "italic") {
+                    format.setFontItalic(true);
+                } else if (style == "underline") {
+                    format.setFontUnderline(true);
+                } else {
+                    qDebug() << "Unknown font style:" << style;
+                }
+            }
+        } else if (key == "caret") {
+            QString color = value.toString();
+            format.setProperty(QTextFormat::UserProperty, QBrush(parseThemeColor(color)));
+        } else {
+            qDebug() << "Unknown key in theme:" << key << "=>" << value;
+        }
+    }
+    return format;
+}
+
+void readSettings(PlistStream& stream, ThemeData& theme)
+{
+    PlistStream::Type type;
+    while ((type = stream.next()) != PlistStream::End) {
+        if (type != PlistStream::Dict) {
+            stream.readValue(type);
+            continue;
+        }
+        bool hasName = false;
+        bool hasScope = false;
+        QString scopes;
+        QTextCharFormat format;
+        while ((type = stream.next()) != PlistStream::End) {
+            QString key = stream.key();
+            if (key == "settings") {
+                format = readFormat(stream, type);
+            } else if (key == "scope") {
+                scopes = stream.readValue(type).toString();
+                hasScope = true;
+            } else {
+                stream.readValue(type);
+                if (key == "name")
+                    hasName = true;
+            }
+        }
+        // XXX What to do when scope is not given?
+        if (hasName && !hasScope)
+            continue;
+        foreach (QString scope, scopes.split(",")) {
+            theme.formats.append(qMakePair(scope.trimmed(), format));
+        }
+    }
+}
+
+}
+
+ThemeData ThemeData::read(PlistStream& stream)
+{
+    ThemeData theme;
+    PlistStream::Type type = stream.next();
+    if (type != PlistStream::Dict) {
+        stream.readValue(type);
+        return theme;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        QString key = stream.key();
+        if (key == "name") {
+            theme.name = stream.readValue(type).toString();
+        } else if (key == "settings" && type == PlistStream::Array) {
+            readSettings(stream, theme);
+        } else {
+            stream.readValue(type);
+        }
+    }
+    return theme;
+}
+
+ThemeData ThemeData::readHeader(PlistStream& stream)
+{
+    ThemeData theme;
+    PlistStream::Type type = stream.next();
+    if (type != PlistStream::Dict) {
+        stream.readValue(type);
+        return theme;
+    }
+    while ((type = stream.next()) != PlistStream::End) {
+        if (stream.key() == "name") {
+            theme.name = stream.readValue(type).toString();
+            break;
+        }
+        if (type == PlistStream::Array || type == PlistStream::Dict)
+            stream.skip();
+    }
+    return theme;
+}
+
 Theme::Theme() :
     d(new ThemePrivate)
 {
@@ -29,53 +182,18 @@ void Theme::clearThemeData()
     d = that.d;
 }
 
-void Theme::setThemeData(const QVariantMap& themeData)
+void Theme::setThemeData(const ThemeData& themeData)
 {
     clearThemeData();
-    QVariantList settingsListData = themeData.value("settings").toList();
-    QListIterator<QVariant> iter(settingsListData);
-    while (iter.hasNext()) {
-        QVariantMap itemData = iter.next().toMap();
-        QTextCharFormat format;
-        QVariantMap settingsData = itemData.value("settings").toMap();
-        QMapIterator<QString, QVariant> settingsIter(settingsData);
-        while (settingsIter.hasNext()) {
-            settingsIter.next();
-            QString key = settingsIter.key();
-            if (key == "foreground") {
-                QString hex = settingsIter.value().toString();
-                format.setForeground(d->parseThemeColor(hex));
-            } else if (key == "background") {
-                QString hex = settingsIter.value().toString();
-                format.setBackground(d->parseThemeColor(hex));
-            } else if (key == "fontStyle") {
-                QString styles = settingsIter.value().toString();
-                QStringList list = styles.split(" ", QString::SkipEmptyParts);
-                foreach (const QString& style, list) {
-                    if (style == "bold") {
-                        format.setFontWeight(75);
-                    } else if (style == "italic") {
-                        format.setFontItalic(true);
-                    } else if (style == "underline") {
-                        format.setFontUnderline(true);
-                    } else {
-                        qDebug() << "Unknown font style:" << style;
-                    }
-                }
-            } else if (key == "caret") {
-                QString color = settingsIter.value().toString();
-                format.setProperty(QTextFormat::UserProperty, QBrush(d->parseThemeColor(color)));
-            } else {
-                qDebug() << "Unknown key in theme:" << key << "=>" << settingsIter.value();
-            }
-        }
-        // XXX What to do when scope is not given?
-        if (itemData.contains("name") && !itemData.contains("scope"))
-            continue;
-        QString scopes = itemData.value("scope").toString();
-        foreach (QString scope, scopes.split(",")) {
-            d->data[scope.trimmed()] = format;
-        }
+    typedef QPair<QString, QTextCharFormat> Format;
+    foreach (const Format& format, themeData.formats) {
+        d->data[format.first] = format.second;
+    }
+
+    QMap<ScopeSelector, QTextCharFormat>::const_iterator it;
+    for (it = d->data.constBegin(); it != d->data.constEnd(); ++it) {
+        d->index.insert(it.key(), d->formats.size());
+        d->formats.append(it.value());
     }
 }
 
@@ -84,33 +202,48 @@ QTextCharFormat Theme::format(const QString& name) const
     return d->data.value(name);
 }
 
-QTextCharFormat Theme::findFormat(const ScopeSelector& scope) const
+QTextCharFormat Theme::findFormat(const ScopeStack& scope) const
 {
-    QTextCharFormat format;
-    QMap<ScopeSelector, QTextCharFormat>::const_iterator it;
-    for (it = d->data.begin(); it != d->data.end(); ++it) {
-        ScopeSelector selector = it.key();
-        if (selector.matches(scope)) {
-            QTextCharFormat old = format;
-            format = it.value();
-            format.merge(old);
-        }
+    ScopeStackKey key = { scope };
+    QHash<ScopeStackKey, QTextCharFormat>::const_iterator it = d->formatCache.constFind(key);
+    if (it != d->formatCache.constEnd()) {
+        d->hits++;
+        return it.value();
     }
+
+    d->misses++;
+    if (d->formatCache.size() >= MaxCachedFormats)
+        d->formatCache.clear();
+    QTextCharFormat format = findFormat(ScopeSelector(scope));
+    d->formatCache.insert(key, format);
     return format;
 }
 
-QColor ThemePrivate::parseThemeColor(const QString& hex)
+int Theme::formatCacheHits() const
 {
-    QRegExp exp("#([\\w\\d]{6})([\\w\\d]{2})");
-    if (exp.exactMatch(hex)) {
-        bool ok = false;
-        QString rgbahex = exp.cap(2) + exp.cap(1);
-        QRgb rgba = rgbahex.toUInt(&ok, 16);
-        if (ok) {
-            return QColor::fromRgba(rgba);
-        }
+    return d->hits;
+}
+
+int Theme::formatCacheMisses() const
+{
+    return d->misses;
+}
+
+int Theme::formatCacheSize() const
+{
+    return d->formatCache.size();
+}
+
+QTextCharFormat Theme::findFormat(const ScopeSelector& scope) const
+{
+    // Earlier selectors in the map take precedence
+    QTextCharFormat format;
+    foreach (int i, d->index.matches(scope)) {
+        QTextCharFormat old = format;
+        format = d->formats.at(i);
+        format.merge(old);
     }
-    return QColor(hex);
+    return format;
 }
 
 bool operator==(const Theme& theme1, const Theme& theme2)
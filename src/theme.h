@@ -1,13 +1,36 @@
 #ifndef THEME_H
 #define THEME_H
 
+#include <QtCore/QList>
+#include <QtCore/QPair>
 #include <QtCore/QSharedPointer>
-#include <QtCore/QVariantMap>
+#include <QtGui/QTextCharFormat>
 
+#include "scopeatoms.h"
+
+class PlistStream;
 class ScopeSelector;
 class ThemePrivate;
 
-class QTextCharFormat;
+/**
+  * The contents of a theme file
+  */
+struct ThemeData {
+    QString name;
+
+    // Scope selectors and their formats, in order
+    QList<QPair<QString, QTextCharFormat> > formats;
+
+    /**
+      * Reads a theme from the stream, keeping only what Theme uses
+      */
+    static ThemeData read(PlistStream& stream);
+
+    /**
+      * Reads only the name, for the list of themes
+      */
+    static ThemeData readHeader(PlistStream& stream);
+};
 
 class Theme
 {
@@ -16,7 +39,7 @@ public:
     ~Theme();
 
     void clearThemeData();
-    void setThemeData(const QVariantMap& themeData);
+    void setThemeData(const ThemeData& themeData);
 
     QTextCharFormat format(const QString& name) const;
 
@@ -28,6 +51,16 @@ public:
       */
     QTextCharFormat findFormat(const ScopeSelector& scope) const;
 
+    /**
+      * Same as above, but the result is cached for each scope stack until
+      * the theme data is set again
+      */
+    QTextCharFormat findFormat(const ScopeStack& scope) const;
+
+    int formatCacheHits() const;
+    int formatCacheMisses() const;
+    int formatCacheSize() const;
+
     friend bool operator==(const Theme& theme1, const Theme& theme2);
     friend bool operator!=(const Theme& theme1, const Theme& theme2);
 
@@ -2,6 +2,8 @@
 #include "navigator.h"
 #include "editor.h"
 #include "bundlemanager.h"
+#include "highlighter.h"
+#include "preferences.h"
 #include "theme.h"
 
 #include <QAction>
@@ -26,6 +28,7 @@ Window::Window(BundleManager* bman, QWidget *parent) :
     vl->setSpacing(0);
 
     editor->setReadOnly(true);
+    editor->setPreferences(bundleManager->preferences());
     editor->setWordWrapMode(QTextOption::NoWrap);
 
     watcher = new QFileSystemWatcher(this);
@@ -133,12 +136,15 @@ void Window::visitFile(const QString &name)
         cursors.insert(name, QTextCursor(doc));
 
         QFileInfo info(name);
-        bundleManager->getHighlighterForExtension(info.completeSuffix(), doc);
+        Highlighter* highlighter = bundleManager->getHighlighterForExtension(info.completeSuffix(), doc);
+        connect(highlighter, SIGNAL(formatsOutdated()), this, SLOT(formatsOutdated()));
     }
 
-    // Bring to front, restore cursor
+    // Bring to front, restore cursor. The theme may have changed while
+    // the document wasn't shown.
     editor->setDocument(documents.value(name));
     editor->setTextCursor(cursors.value(name));
+    editor->updateFormats();
 
     // Apparently, we need to repeat tab stop width when changing documents
     editor->setTabStopWidth(QFontMetrics(editor->font()).width(' ') * 4);
@@ -235,3 +241,14 @@ void Window::themeChanged(const Theme& theme)
     p.setBrush(QPalette::Text, baseFormat.brushProperty(QTextFormat::UserProperty));
     editor->setPalette(p);
 }
+
+/**
+  * Documents that aren't shown get the formats of the new theme when they're
+  * shown again
+  */
+void Window::formatsOutdated()
+{
+    Highlighter* highlighter = qobject_cast<Highlighter*>(sender());
+    if (highlighter && highlighter->document() == editor->document())
+        editor->updateFormats();
+}
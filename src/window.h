@@ -41,6 +41,7 @@ private slots:
 
 private slots:
     void themeChanged(const Theme& theme);
+    void formatsOutdated();
 
 private:
     Editor* editor;
@@ -2,5 +2,10 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     libqgit2 \
-    src
+    src \
+    tools/grammaranalyzer \
+    tools/themebenchmark \
+    tools/highlightbenchmark \
+    tools/regexbenchmark \
+    tools/bundlebenchmark
 
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Times reading bundles in each property list format, with each reader,
+# and loading them on one thread and on several
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = bundlebenchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../src/src.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,542 @@
+#include "bundlecache.h"
+#include "bundlemanager.h"
+#include "plistreader.h"
+#include "preferences.h"
+#include "syntaxdata.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QProcess>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVariant>
+
+/*
+  Compares ways of reading the bundles of a directory. Their syntax and
+  preference files are converted to XML, binary and JSON property lists,
+  and must read back the same in each format. Each copy is then read with
+  PlistStream, through a QVariant tree with PlistReader, and through a
+  BundleCache. Last, BundleManager::readBundles() loads the XML copy on one
+  thread, and on the whole thread pool, to give the speedup of loading files
+  in parallel.
+
+  Every measurement runs in a process of its own, so the peak memory it
+  reports is its own. The first pass reads the cache as the conversion left
+  it, which is out of date, and later passes read it as saved by the first.
+  */
+
+namespace {
+
+const int DefaultRepeat = 5;
+
+const char* const Formats[] = { "xml", "binary", "json" };
+const char* const Readers[] = { "stream", "variant", "cache" };
+
+void _PrintUsage()
+{
+    QTextStream err(stderr);
+    err << "Usage: bundlebenchmark [--repeat N] BUNDLE_DIR\n"
+        << "\n"
+        << "  --repeat N   Read the bundles N times in each measurement (default " << DefaultRepeat << ")\n";
+}
+
+/**
+  * Returns the syntax and preference files of the bundles under path,
+  * like BundleManager::readBundles() finds them
+  */
+QStringList _BundleFiles(const QString& path)
+{
+    QStringList files;
+    QDir bundleDir(path);
+    bundleDir.setFilter(QDir::Dirs);
+    bundleDir.setNameFilters(QStringList() << "*.tmbundle");
+    foreach (const QString& bundleName, bundleDir.entryList()) {
+        const QString bundlePath = bundleDir.filePath(bundleName);
+        QDir syntaxDir(bundlePath + "/Syntaxes");
+        syntaxDir.setFilter(QDir::Files);
+        syntaxDir.setNameFilters(QStringList() << "*.plist" << "*.tmLanguage" << "*.tmLanguage.json");
+        foreach (const QString& file, syntaxDir.entryList())
+            files << syntaxDir.filePath(file);
+        QDir preferenceDir(bundlePath + "/Preferences");
+        preferenceDir.setFilter(QDir::Files);
+        preferenceDir.setNameFilters(QStringList() << "*.plist" << "*.tmPreferences" << "*.tmPreferences.json");
+        foreach (const QString& file, preferenceDir.entryList())
+            files << preferenceDir.filePath(file);
+    }
+    return files;
+}
+
+bool _IsSyntaxFile(const QString& path)
+{
+    return path.contains("/Syntaxes/");
+}
+
+/**
+  * Returns the peak resident memory of the process in kB, or -1 if it's not
+  * known
+  */
+long _PeakMemory()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QFile::ReadOnly))
+        return -1;
+    foreach (const QByteArray& line, status.readAll().split('\n')) {
+        if (line.startsWith("VmHWM:"))
+            return line.mid(6).trimmed().split(' ').first().toLong();
+    }
+    return -1;
+}
+
+QString _EscapeXml(const QString& text)
+{
+    QString escaped = text;
+    escaped.replace("&", "&amp;");
+    escaped.replace("<", "&lt;");
+    escaped.replace(">", "&gt;");
+    return escaped;
+}
+
+void _WriteXml(const QVariant& value, QString& out)
+{
+    switch (value.type()) {
+    case QVariant::String:
+        out += "<string>" + _EscapeXml(value.toString()) + "</string>";
+        break;
+    case QVariant::Int:
+        out += "<integer>" + QString::number(value.toInt()) + "</integer>";
+        break;
+    case QVariant::List:
+        out += "<array>";
+        foreach (const QVariant& item, value.toList())
+            _WriteXml(item, out);
+        out += "</array>";
+        break;
+    case QVariant::Map: {
+        out += "<dict>";
+        const QVariantMap map = value.toMap();
+        for (QVariantMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+            out += "<key>" + _EscapeXml(it.key()) + "</key>";
+            _WriteXml(it.value(), out);
+        }
+        out += "</dict>";
+        break;
+    }
+    default:
+        // Read as unknown, like any value of a type that isn't supported
+        out += "<false/>";
+        break;
+    }
+}
+
+QString _JsonString(const QString& text)
+{
+    QString quoted = "\"";
+    foreach (QChar c, text) {
+        if (c == '"' || c == '\\')
+            quoted += QString("\\") + c;
+        else if (c == '\n')
+            quoted += "\\n";
+        else if (c == '\t')
+            quoted += "\\t";
+        else if (c.unicode() < 0x20)
+            quoted += QString("\\u%1").arg(c.unicode(), 4, 16, QLatin1Char('0'));
+        else
+            quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void _WriteJson(const QVariant& value, QString& out)
+{
+    switch (value.type()) {
+    case QVariant::String:
+        out += _JsonString(value.toString());
+        break;
+    case QVariant::Int:
+        out += QString::number(value.toInt());
+        break;
+    case QVariant::List: {
+        out += "[";
+        const QVariantList list = value.toList();
+        for (int i = 0; i < list.size(); i++) {
+            if (i > 0)
+                out += ",";
+            _WriteJson(list.at(i), out);
+        }
+        out += "]";
+        break;
+    }
+    case QVariant::Map: {
+        out += "{";
+        const QVariantMap map = value.toMap();
+        for (QVariantMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+            if (it != map.begin())
+                out += ",";
+            out += _JsonString(it.key()) + ":";
+            _WriteJson(it.value(), out);
+        }
+        out += "}";
+        break;
+    }
+    default:
+        out += "null";
+        break;
+    }
+}
+
+/**
+  * Writes a binary property list (bplist00), with every key and value as
+  * an object of its own
+  */
+class BinaryPlistWriter
+{
+public:
+    QByteArray write(const QVariant& value)
+    {
+        const quint64 count = countObjects(value);
+        refSize = count < 0x100 ? 1 : count < 0x10000 ? 2 : 4;
+        data = "bplist00";
+        offsets.clear();
+
+        const quint64 top = writeObject(value);
+        const quint64 offsetTable = data.size();
+        foreach (quint64 offset, offsets)
+            appendInteger(offset, 4);
+        data.append(QByteArray(6, '\0'));
+        data.append(char(4));
+        data.append(char(refSize));
+        appendInteger(offsets.size(), 8);
+        appendInteger(top, 8);
+        appendInteger(offsetTable, 8);
+        return data;
+    }
+
+private:
+    quint64 countObjects(const QVariant& value) const
+    {
+        quint64 count = 1;
+        if (value.type() == QVariant::List) {
+            foreach (const QVariant& item, value.toList())
+                count += countObjects(item);
+        } else if (value.type() == QVariant::Map) {
+            foreach (const QVariant& item, value.toMap())
+                count += 1 + countObjects(item);
+        }
+        return count;
+    }
+
+    void appendInteger(quint64 value, int size)
+    {
+        for (int i = size - 1; i >= 0; i--)
+            data.append(char(value >> (8 * i)));
+    }
+
+    void appendMarker(int type, quint64 length)
+    {
+        if (length < 0xf) {
+            data.append(char(type << 4 | length));
+        } else {
+            data.append(char(type << 4 | 0xf));
+            data.append(char(0x12));
+            appendInteger(length, 4);
+        }
+    }
+
+    quint64 beginObject()
+    {
+        offsets.append(data.size());
+        return offsets.size() - 1;
+    }
+
+    quint64 writeString(const QString& text)
+    {
+        const quint64 ref = beginObject();
+        bool ascii = true;
+        foreach (QChar c, text)
+            ascii = ascii && c.unicode() < 0x80;
+        if (ascii) {
+            appendMarker(0x5, text.length());
+            data.append(text.toLatin1());
+        } else {
+            appendMarker(0x6, text.length());
+            foreach (QChar c, text)
+                appendInteger(c.unicode(), 2);
+        }
+        return ref;
+    }
+
+    quint64 writeObject(const QVariant& value)
+    {
+        // Containers are written after their items, to know their references
+        QList<quint64> refs;
+        int type;
+        switch (value.type()) {
+        case QVariant::String:
+            return writeString(value.toString());
+        case QVariant::Int: {
+            const quint64 ref = beginObject();
+            data.append(char(0x13));
+            appendInteger(qint64(value.toInt()), 8);
+            return ref;
+        }
+        case QVariant::List:
+            type = 0xa;
+            foreach (const QVariant& item, value.toList())
+                refs << writeObject(item);
+            break;
+        case QVariant::Map: {
+            type = 0xd;
+            const QVariantMap map = value.toMap();
+            foreach (const QString& key, map.keys())
+                refs << writeString(key);
+            foreach (const QVariant& item, map.values())
+                refs << writeObject(item);
+            break;
+        }
+        default: {
+            const quint64 ref = beginObject();
+            data.append(char(0x00));
+            return ref;
+        }
+        }
+
+        const quint64 ref = beginObject();
+        appendMarker(type, type == 0xd ? refs.size() / 2 : refs.size());
+        foreach (quint64 item, refs)
+            appendInteger(item, refSize);
+        return ref;
+    }
+
+    QByteArray data;
+    QList<quint64> offsets;
+    int refSize;
+};
+
+QVariant _ReadValue(const QString& path)
+{
+    QScopedPointer<PlistStream> stream(PlistStream::open(path));
+    return stream->readValue(stream->next());
+}
+
+/**
+  * Writes the files under from to the same paths under to, in a format.
+  * Returns the number of files that don't read back the same.
+  */
+int _Convert(const QString& from, const QString& to, const QStringList& files, const QString& format)
+{
+    int differences = 0;
+    foreach (const QString& path, files) {
+        const QVariant value = _ReadValue(path);
+        QByteArray bytes;
+        if (format == "binary") {
+            bytes = BinaryPlistWriter().write(value);
+        } else if (format == "json") {
+            QString json;
+            _WriteJson(value, json);
+            bytes = json.toUtf8();
+        } else {
+            QString xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                          "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+                          "<plist version=\"1.0\">";
+            _WriteXml(value, xml);
+            xml += "</plist>\n";
+            bytes = xml.toUtf8();
+        }
+
+        const QString copy = to + path.mid(from.length());
+        QDir().mkpath(QFileInfo(copy).path());
+        QFile file(copy);
+        if (!file.open(QFile::WriteOnly | QFile::Truncate) || file.write(bytes) != bytes.size()) {
+            qWarning("Can't write %s", qPrintable(copy));
+            return differences + 1;
+        }
+        file.close();
+
+        if (_ReadValue(copy) != value) {
+            qWarning("%s reads back differently as %s", qPrintable(path), qPrintable(format));
+            differences++;
+        }
+    }
+    return differences;
+}
+
+/**
+  * Prints the time of the first pass and the best of the others, in ms, and
+  * the peak memory in kB
+  */
+void _PrintPasses(const QList<qint64>& passes)
+{
+    qint64 best = passes.size() > 1 ? passes.at(1) : passes.first();
+    foreach (qint64 pass, passes.mid(1))
+        best = qMin(best, pass);
+    QTextStream(stdout) << passes.first() << " " << best << " " << _PeakMemory() << "\n";
+}
+
+/**
+  * Reads all the files with a reader, keeping what was read until the pass
+  * is done
+  */
+int _Read(const QString& reader, const QString& path, int repeat)
+{
+    const QStringList files = _BundleFiles(path);
+    QList<qint64> passes;
+    for (int pass = 0; pass < repeat; pass++) {
+        QList<SyntaxData> syntaxes;
+        QList<PreferenceData> preferences;
+        QScopedPointer<BundleCache> cache(reader == "cache" ? new BundleCache(path) : 0);
+        QElapsedTimer timer;
+        timer.start();
+        foreach (const QString& file, files) {
+            QScopedPointer<PlistStream> stream;
+            if (cache) {
+                stream.reset(cache->read(file));
+            } else if (reader == "variant") {
+                PlistReader plistReader;
+                stream.reset(new PlistVariantStream(plistReader.read(file)));
+            } else {
+                stream.reset(PlistStream::open(file));
+            }
+            if (_IsSyntaxFile(file))
+                syntaxes << SyntaxData::read(*stream);
+            else
+                preferences << PreferenceData::read(*stream);
+        }
+        // The cache is saved when it goes, out of the time
+        passes << timer.elapsed();
+    }
+    _PrintPasses(passes);
+    return 0;
+}
+
+/**
+  * Loads the bundles like the editor does, on a number of threads
+  */
+int _Load(int threads, const QString& path, int repeat)
+{
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    QList<qint64> passes;
+    for (int pass = 0; pass < repeat; pass++) {
+        QElapsedTimer timer;
+        timer.start();
+        BundleManager manager;
+        manager.readBundles(path);
+        passes << timer.elapsed();
+    }
+    _PrintPasses(passes);
+    return 0;
+}
+
+/**
+  * Runs a measurement in a process of its own, and returns the first pass,
+  * best pass and peak memory it printed, or an empty list
+  */
+QList<qint64> _Measure(const QStringList& arguments)
+{
+    QProcess process;
+    process.start(QCoreApplication::applicationFilePath(), arguments);
+    if (!process.waitForFinished(-1) || process.exitCode() != 0)
+        return QList<qint64>();
+    QList<qint64> values;
+    foreach (const QByteArray& field, process.readAllStandardOutput().trimmed().split(' '))
+        values << field.toLongLong();
+    return values.size() == 3 ? values : QList<qint64>();
+}
+
+QString _Describe(const QList<qint64>& values)
+{
+    if (values.isEmpty())
+        return "failed";
+    return QString("first %1 ms, best %2 ms, peak %3 kB").arg(values.at(0)).arg(values.at(1)).arg(values.at(2));
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int repeat = DefaultRepeat;
+    QString reader;
+    int threads = 0;
+    QStringList paths;
+    QStringList args = app.arguments().mid(1);
+    while (!args.isEmpty()) {
+        const QString arg = args.takeFirst();
+        bool ok = true;
+        if (arg == "--repeat" && !args.isEmpty()) {
+            repeat = args.takeFirst().toInt(&ok);
+            ok = ok && repeat > 0;
+        } else if (arg == "--read" && !args.isEmpty()) {
+            // Used for the measurements in processes of their own
+            reader = args.takeFirst();
+        } else if (arg == "--load" && !args.isEmpty()) {
+            threads = args.takeFirst().toInt(&ok);
+            ok = ok && threads > 0;
+        } else if (arg.startsWith("-")) {
+            ok = false;
+        } else {
+            paths << arg;
+        }
+        if (!ok) {
+            _PrintUsage();
+            return 1;
+        }
+    }
+    if (paths.size() != 1) {
+        _PrintUsage();
+        return 1;
+    }
+    const QString path = QDir(paths.first()).absolutePath();
+
+    if (!reader.isEmpty())
+        return _Read(reader, path, repeat);
+    if (threads > 0)
+        return _Load(threads, path, repeat);
+
+    const QStringList files = _BundleFiles(path);
+    if (files.isEmpty()) {
+        qWarning("No syntax or preference files in %s", qPrintable(path));
+        return 1;
+    }
+
+    QTextStream out(stdout);
+    out << files.size() << " syntax and preference files, " << repeat << " passes each\n";
+
+    const QString base = QDir::tempPath() + "/bundlebenchmark";
+    const QString repeatArg = QString::number(repeat);
+    int differences = 0;
+    for (uint f = 0; f < sizeof(Formats) / sizeof(Formats[0]); f++) {
+        const QString copy = base + "/" + Formats[f];
+        differences += _Convert(path, copy, files, Formats[f]);
+        for (uint r = 0; r < sizeof(Readers) / sizeof(Readers[0]); r++) {
+            const QList<qint64> values = _Measure(QStringList() << "--repeat" << repeatArg << "--read" << Readers[r] << copy);
+            out << QString("%1 %2: ").arg(QString(Formats[f]), -7).arg(QString(Readers[r]), -8) << _Describe(values) << "\n";
+        }
+    }
+
+    // A fresh copy for each, so the first pass finds the cache out of date
+    QList<int> threadCounts;
+    threadCounts << 1;
+    if (QThread::idealThreadCount() > 1)
+        threadCounts << QThread::idealThreadCount();
+    QList<QList<qint64> > loads;
+    foreach (int count, threadCounts) {
+        const QString copy = base + "/load-" + QString::number(count);
+        differences += _Convert(path, copy, files, "xml");
+        loads << _Measure(QStringList() << "--repeat" << repeatArg << "--load" << QString::number(count) << copy);
+        out << "readBundles on " << count << (count == 1 ? " thread: " : " threads: ") << _Describe(loads.last()) << "\n";
+    }
+    if (loads.size() < 2)
+        out << "One core only, so loading on several threads isn't measured\n";
+    else if (!loads.first().isEmpty() && !loads.last().isEmpty() && loads.last().at(0) > 0)
+        out << "Several threads load " << QString::number(double(loads.first().at(0)) / loads.last().at(0), 'f', 2)
+            << " times as fast cold\n";
+
+    out << differences << " files read back differently\n";
+    return differences == 0 ? 0 : 2;
+}
@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Ranks the patterns of bundle grammars by worst case search time
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = grammaranalyzer
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../src/src.pri)
+
+SOURCES += main.cpp \
+    patternanalyzer.cpp
+
+HEADERS += patternanalyzer.h
@@ -0,0 +1,246 @@
+#include "bundlemanager.h"
+#include "grammar.h"
+#include "patternanalyzer.h"
+#include "regex.h"
+#include "regexengine.h"
+#include "ruledata.h"
+#include "scopeatoms.h"
+
+#include <QtCore/QBitArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QPair>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QSet>
+#include <QtCore/QTextStream>
+#include <QtCore/QtAlgorithms>
+
+/*
+  Loads the grammars of bundle directories, and ranks their patterns by how
+  long a search can take on a line made to be slow. Patterns with constructs
+  that are known to backtrack badly are flagged, see patternRisks().
+
+  Searches use Oniguruma only, unless --engines is given, since the other
+  engines don't backtrack. A search that exceeds the retry limit gives up,
+  and is reported as aborted, like it would be in the editor.
+  */
+
+namespace {
+
+const int DefaultTop = 50;
+const unsigned long DefaultRetryLimit = 10000000;
+
+struct PatternReport {
+    QString scopeName;
+    QString rule;           // Scope name of the rule, and which pattern
+    QString pattern;
+    int risks;
+    qint64 worstTime;       // Nanoseconds
+    int worstLength;        // Length of the slowest input
+    bool aborted;
+};
+
+bool _Slower(const PatternReport& a, const PatternReport& b)
+{
+    if (a.aborted != b.aborted)
+        return a.aborted;
+    return a.worstTime > b.worstTime;
+}
+
+void _PrintUsage()
+{
+    QTextStream err(stderr);
+    err << "Usage: grammaranalyzer [--top N] [--retry-limit N] [--engines] BUNDLE_DIR...\n"
+        << "\n"
+        << "  --top N           Print the N slowest patterns (default " << DefaultTop << ", 0 for all)\n"
+        << "  --retry-limit N   Give up a search after N retries (default " << DefaultRetryLimit << ")\n"
+        << "  --engines         Search with the regex engines, not only Oniguruma\n";
+}
+
+void _CollectRules(const GrammarData& data, RuleId id, QBitArray& seen, QVector<RuleId>& rules)
+{
+    if (id == NoRule || seen.testBit(id))
+        return;
+    seen.setBit(id);
+    rules << id;
+
+    // Include rules are collected, but not the rules they refer to
+    const RuleData& rule = data.rules.at(id);
+    for (int i = 0; i < rule.patterns.count; i++)
+        _CollectRules(data, data.children.at(rule.patterns.start + i), seen, rules);
+    const RuleSpan captures[] = { rule.captures, rule.beginCaptures, rule.endCaptures };
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < captures[c].count; i++)
+            _CollectRules(data, data.captureRules.at(captures[c].start + i), seen, rules);
+    }
+}
+
+/**
+  * Makes all the rules reachable in the grammar for scopeName, and returns
+  * those of the grammar itself, not of the grammars it includes
+  */
+QVector<RuleId> _GrammarRules(const Grammar& grammar, GrammarData& data, const QString& scopeName)
+{
+    QWriteLocker locker(&data.lock);
+
+    // Resolving adds the rules reached to the end of the table
+    for (RuleId id = 0; id < data.rules.size(); id++)
+        grammar.resolveChildRules(data, id);
+
+    const RuleId root = data.grammars.value(scopeName, data.root);
+    QBitArray seen(data.rules.size());
+    QVector<RuleId> rules;
+    _CollectRules(data, root, seen, rules);
+    foreach (RuleId id, data.repositories.value(root))
+        _CollectRules(data, id, seen, rules);
+    return rules;
+}
+
+/**
+  * Times searches of the pattern in its worst case inputs, stopping at the
+  * first one that exceeds the search limits
+  */
+PatternReport _Analyze(const QString& pattern, bool searchedEverywhere, const QList<int>& lengths)
+{
+    PatternReport report;
+    report.pattern = pattern;
+    report.worstTime = 0;
+    report.worstLength = 0;
+    report.aborted = false;
+
+    RegexParser parser;
+    RegexNodePtr root = parser.parse(pattern);
+    report.risks = patternRisks(root, searchedEverywhere);
+
+    Regex regex(pattern);
+    if (!regex.isValid())
+        return report;
+
+    Match match;
+    QElapsedTimer timer;
+    foreach (const QString& input, worstCaseInputs(root, lengths, qHash(pattern))) {
+        SearchTarget target(input.begin(), input.end());
+        timer.start();
+        regex.search(target, target.begin(), target.end(), match);
+        const qint64 time = timer.nsecsElapsed();
+        if (time > report.worstTime) {
+            report.worstTime = time;
+            report.worstLength = input.size();
+        }
+        if (target.isAborted()) {
+            report.aborted = true;
+            break;
+        }
+    }
+    return report;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int top = DefaultTop;
+    unsigned long retryLimit = DefaultRetryLimit;
+    bool engines = false;
+    QStringList paths;
+    QStringList args = app.arguments().mid(1);
+    while (!args.isEmpty()) {
+        const QString arg = args.takeFirst();
+        bool ok = true;
+        if (arg == "--top" && !args.isEmpty()) {
+            top = args.takeFirst().toInt(&ok);
+        } else if (arg == "--retry-limit" && !args.isEmpty()) {
+            retryLimit = args.takeFirst().toULong(&ok);
+        } else if (arg == "--engines") {
+            engines = true;
+        } else if (arg.startsWith("-")) {
+            ok = false;
+        } else {
+            paths << arg;
+        }
+        if (!ok) {
+            _PrintUsage();
+            return 1;
+        }
+    }
+    if (paths.isEmpty()) {
+        _PrintUsage();
+        return 1;
+    }
+
+    setRegexEnginesEnabled(engines);
+    Regex::setSearchLimits(retryLimit, 0);
+
+    BundleManager manager;
+    foreach (const QString& path, paths)
+        manager.readBundles(path);
+    Grammar grammar = manager.grammar();
+
+    QList<int> lengths;
+    lengths << 16 << 64 << 256 << 1024 << 4096;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QList<PatternReport> reports;
+    int grammars = 0;
+    foreach (const QString& scopeName, manager.scopeNames()) {
+        GrammarDataPtr data = grammar.compile(scopeName);
+        if (!data)
+            continue;
+        grammars++;
+
+        QSet<QString> seen;
+        foreach (RuleId id, _GrammarRules(grammar, *data, scopeName)) {
+            // Not changed anymore, so it's read without the lock
+            const RuleData& rule = data->rules.at(id);
+            QList<QPair<QString, QString> > patterns;
+            if (!rule.beginPattern.isNull())
+                patterns << qMakePair(QString("begin"), rule.beginPattern);
+            if (!rule.matchPattern.isNull())
+                patterns << qMakePair(QString("match"), rule.matchPattern);
+            if (!rule.endPattern.isNull() && !rule.endHasBackReferences)
+                patterns << qMakePair(QString("end"), rule.endPattern);
+
+            typedef QPair<QString, QString> Pattern;
+            foreach (const Pattern& pattern, patterns) {
+                if (seen.contains(pattern.second))
+                    continue;
+                seen.insert(pattern.second);
+
+                // Begin and match patterns are tried at every position
+                PatternReport report = _Analyze(pattern.second, pattern.first != "end", lengths);
+                report.scopeName = scopeName;
+                const QString name = ScopeAtoms::name(rule.name);
+                report.rule = name.isEmpty() ? pattern.first : name + " " + pattern.first;
+                reports << report;
+            }
+        }
+    }
+    qSort(reports.begin(), reports.end(), _Slower);
+
+    int flagged = 0;
+    int aborted = 0;
+    foreach (const PatternReport& report, reports) {
+        if (report.risks)
+            flagged++;
+        if (report.aborted)
+            aborted++;
+    }
+
+    QTextStream out(stdout);
+    out << "Analyzed " << reports.size() << " patterns in " << grammars << " grammars in "
+        << elapsed.elapsed() << " ms, " << flagged << " flagged, " << aborted
+        << " exceeded the retry limit\n\n";
+    for (int i = 0; i < reports.size() && (top == 0 || i < top); i++) {
+        const PatternReport& report = reports.at(i);
+        out << QString("%1 ms").arg(report.worstTime / 1e6, 10, 'f', 3)
+            << QString("%1").arg(report.worstLength, 6)
+            << (report.aborted ? "  aborted" : "")
+            << (report.risks ? "  " + patternRiskNames(report.risks) : QString())
+            << "  " << report.scopeName << ": " << report.rule << "\n"
+            << "    " << report.pattern << "\n";
+    }
+    return 0;
+}
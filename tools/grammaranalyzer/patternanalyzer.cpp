@@ -0,0 +1,295 @@
+#include "patternanalyzer.h"
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+namespace {
+
+const int MaxPumpedRepeats = 16;
+const int MaxSampleRepeats = 64;
+const int RandomInputs = 16;
+const int RandomInputLength = 1024;
+
+// Characters that end a run, tried in order
+const char EndChars[] = "!\"' ;#~\x01";
+
+bool isMultiRepeat(const RegexNodePtr& node)
+{
+    return node->type == RegexNode::Repeat && (node->max == -1 || node->max > 1);
+}
+
+/**
+  * True unless both sets are known and have nothing in common
+  */
+bool mayOverlap(bool knownA, const RegexCharSet& a, bool knownB, const RegexCharSet& b)
+{
+    if (!knownA || !knownB)
+        return true;
+    for (int i = 0; i < 8; i++) {
+        if (a.bits[i] & b.bits[i])
+            return true;
+    }
+    return a.other && b.other;
+}
+
+/**
+  * Finds risks below node. outer is the child of the nearest enclosing
+  * repeat that can backtrack, if any.
+  */
+void collectRisks(const RegexNodePtr& node, const RegexNodePtr& outer, int* risks)
+{
+    switch (node->type) {
+    case RegexNode::Repeat: {
+        if (!isMultiRepeat(node))
+            break;
+        const RegexNodePtr& child = node->children.at(0);
+        if (outer) {
+            RegexCharSet outerFirst, innerFirst;
+            bool outerKnown = regexFirstChars(outer, &outerFirst);
+            bool innerKnown = regexFirstChars(child, &innerFirst);
+            if (mayOverlap(outerKnown, outerFirst, innerKnown, innerFirst))
+                *risks |= NestedQuantifier;
+        }
+        collectRisks(child, child, risks);
+        return;
+    }
+    case RegexNode::Atomic:
+        // A possessive repeat doesn't give back, so it can't be split either
+        if (node->children.at(0)->type == RegexNode::Repeat) {
+            foreach (const RegexNodePtr& child, node->children.at(0)->children)
+                collectRisks(child, outer, risks);
+            return;
+        }
+        break;
+    case RegexNode::Alternation:
+        if (outer) {
+            QList<RegexCharSet> firsts;
+            QVector<bool> known;
+            foreach (const RegexNodePtr& child, node->children) {
+                RegexCharSet first;
+                known << regexFirstChars(child, &first);
+                firsts << first;
+            }
+            for (int i = 0; i < firsts.size(); i++) {
+                for (int j = i + 1; j < firsts.size(); j++) {
+                    if (known.at(i) && known.at(j) && mayOverlap(true, firsts.at(i), true, firsts.at(j)))
+                        *risks |= OverlappingAlternation;
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    foreach (const RegexNodePtr& child, node->children)
+        collectRisks(child, outer, risks);
+}
+
+/**
+  * Returns the first node that consumes text, looking into groups and
+  * sequences, or a null pointer if the pattern is anchored before it
+  */
+RegexNodePtr leadingNode(const RegexNodePtr& node)
+{
+    switch (node->type) {
+    case RegexNode::Group:
+    case RegexNode::Atomic:
+        return leadingNode(node->children.at(0));
+    case RegexNode::Concat:
+        foreach (const RegexNodePtr& child, node->children) {
+            if (child->type == RegexNode::Assertion) {
+                if (child->assertion == RegexNode::LineStart || child->assertion == RegexNode::TextStart
+                        || child->assertion == RegexNode::SearchStart)
+                    return RegexNodePtr();
+                continue;
+            }
+            if (child->type != RegexNode::LookAround && child->type != RegexNode::Empty)
+                return leadingNode(child);
+        }
+        return RegexNodePtr();
+    default:
+        return node;
+    }
+}
+
+bool isDotStar(const RegexNodePtr& node)
+{
+    if (!node || node->type != RegexNode::Repeat || node->max != -1)
+        return false;
+    const RegexNodePtr& child = node->children.at(0);
+    return child->type == RegexNode::Any || (child->type == RegexNode::Class && child->negated);
+}
+
+/**
+  * Returns a character matched by a Char, Class or Any node, preferring
+  * letters and digits
+  */
+QChar sampleChar(const RegexNode& node)
+{
+    static const char preferred[] = "aZ0_ -.\"'(";
+    for (const char* c = preferred; *c; c++) {
+        if (node.matches(uchar(*c)))
+            return QChar(*c);
+    }
+    for (ushort c = 1; c < 0x3000; c++) {
+        if (node.matches(c))
+            return QChar(c);
+    }
+    return QChar('a');
+}
+
+/**
+  * Appends a short string matched by node to out. If node is or contains
+  * stop, the text up to stop is appended instead, and true is returned.
+  */
+bool sample(const RegexNodePtr& node, const RegexNode* stop, QString* out)
+{
+    if (node.data() == stop)
+        return true;
+
+    switch (node->type) {
+    case RegexNode::Char:
+    case RegexNode::Class:
+    case RegexNode::Any:
+        out->append(sampleChar(*node));
+        return false;
+    case RegexNode::Group:
+    case RegexNode::Atomic:
+    case RegexNode::Concat:
+        foreach (const RegexNodePtr& child, node->children) {
+            if (sample(child, stop, out))
+                return true;
+        }
+        return false;
+    case RegexNode::Alternation:
+        // The branch with stop, or else the first one
+        foreach (const RegexNodePtr& child, node->children) {
+            QString branch;
+            if (sample(child, stop, &branch)) {
+                out->append(branch);
+                return true;
+            }
+        }
+        return sample(node->children.at(0), 0, out);
+    case RegexNode::Repeat:
+        if (node->min == 0) {
+            // Nothing, unless stop is inside
+            QString once;
+            if (sample(node->children.at(0), stop, &once)) {
+                out->append(once);
+                return true;
+            }
+            return false;
+        }
+        for (int i = 0; i < qMin(node->min, MaxSampleRepeats); i++) {
+            if (sample(node->children.at(0), stop, out))
+                return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+void collectRepeats(const RegexNodePtr& node, QList<RegexNodePtr>* repeats)
+{
+    if (isMultiRepeat(node))
+        repeats->append(node);
+    foreach (const RegexNodePtr& child, node->children)
+        collectRepeats(child, repeats);
+}
+
+void collectChars(const RegexNodePtr& node, QString* chars)
+{
+    if (node->type == RegexNode::Char || node->type == RegexNode::Class || node->type == RegexNode::Any) {
+        QChar c = sampleChar(*node);
+        if (!chars->contains(c))
+            chars->append(c);
+    }
+    foreach (const RegexNodePtr& child, node->children)
+        collectChars(child, chars);
+}
+
+/**
+  * Returns a character that the repeated node can't start with, to make
+  * the match fail after a long run
+  */
+QChar endChar(const RegexNodePtr& repeated)
+{
+    RegexCharSet first;
+    bool known = regexFirstChars(repeated, &first);
+    for (const char* c = EndChars; *c; c++) {
+        if (!known || !first.contains(uchar(*c)))
+            return QChar(*c);
+    }
+    return QChar(0x2603);
+}
+
+}
+
+int patternRisks(const RegexNodePtr& root, bool begin)
+{
+    int risks = 0;
+    if (!root)
+        return risks;
+    collectRisks(root, RegexNodePtr(), &risks);
+    if (begin && isDotStar(leadingNode(root)))
+        risks |= LeadingDotStar;
+    return risks;
+}
+
+QString patternRiskNames(int risks)
+{
+    QStringList names;
+    if (risks & NestedQuantifier)
+        names << "nested-quantifier";
+    if (risks & LeadingDotStar)
+        names << "leading-dot-star";
+    if (risks & OverlappingAlternation)
+        names << "overlapping-alternation";
+    return names.join(",");
+}
+
+QStringList worstCaseInputs(const RegexNodePtr& root, const QList<int>& lengths, uint seed)
+{
+    QStringList inputs;
+    QString chars;
+    QList<RegexNodePtr> repeats;
+    if (root) {
+        collectRepeats(root, &repeats);
+        collectChars(root, &chars);
+    }
+    // Patterns that need a literal are skipped quickly on lines without
+    // it, so each line is also tried with a match after the run
+    QString match;
+    if (root)
+        sample(root, 0, &match);
+
+    foreach (const RegexNodePtr& repeat, repeats.mid(0, MaxPumpedRepeats)) {
+        QString prefix;
+        sample(root, repeat.data(), &prefix);
+        QString unit;
+        sample(repeat->children.at(0), 0, &unit);
+        if (unit.isEmpty())
+            continue;
+        const QChar end = endChar(repeat->children.at(0));
+        foreach (int length, lengths) {
+            QString input = prefix;
+            while (input.size() < length)
+                input += unit;
+            inputs << input + end;
+            inputs << input + end + match;
+        }
+    }
+
+    chars += " \t!\"#'()[]{}<>\\/.-_aZ09";
+    qsrand(seed);
+    for (int i = 0; i < RandomInputs; i++) {
+        QString input;
+        for (int j = 0; j < RandomInputLength; j++)
+            input += chars.at(qrand() % chars.size());
+        inputs << input;
+    }
+    return inputs;
+}
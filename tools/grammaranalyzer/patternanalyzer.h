@@ -0,0 +1,46 @@
+#ifndef PATTERNANALYZER_H
+#define PATTERNANALYZER_H
+
+#include "regexsyntax.h"
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+/**
+  * Constructs that can make a backtracking search take exponential or
+  * quadratic time on lines that almost match
+  */
+enum PatternRisk {
+    NestedQuantifier = 0x1,         // (a+)+, a run can be split between the repeats in many ways
+    LeadingDotStar = 0x2,           // .* first in a begin pattern, tried to the end of the line from each position
+    OverlappingAlternation = 0x4    // (a|ab)*, repeated alternatives that can start with the same character
+};
+
+/**
+  * Returns the PatternRisk flags found in the syntax tree of a pattern.
+  * begin is true for begin patterns, which are searched for from every
+  * position of a line.
+  *
+  * The checks look at first characters only, so they find likely problems,
+  * not proven ones. Possessive quantifiers and atomic groups don't give
+  * back what they matched, and aren't flagged.
+  */
+int patternRisks(const RegexNodePtr& root, bool begin);
+
+/**
+  * Returns the names of the risk flags, separated by commas
+  */
+QString patternRiskNames(int risks);
+
+/**
+  * Returns inputs that are likely to make a backtracking search of the
+  * pattern slow. For each repeat in the pattern, a line starting with what
+  * matches up to the repeat, followed by many repetitions and a character
+  * that ends the match, at each length in lengths, with and without a match
+  * of the whole pattern at the end. Some random lines made
+  * of the characters in the pattern are added, seeded by seed. Only random
+  * lines are returned if the pattern couldn't be parsed.
+  */
+QStringList worstCaseInputs(const RegexNodePtr& root, const QList<int>& lengths, uint seed);
+
+#endif // PATTERNANALYZER_H
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Times highlighting files, and checks that it allocates no matches once
+# the grammar is warmed up
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = highlightbenchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../src/src.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,147 @@
+#include "bundlemanager.h"
+#include "grammar.h"
+#include "highlighter.h"
+#include "regex.h"
+#include "ruledata.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QTextStream>
+#include <QtGui/QApplication>
+#include <QtGui/QTextDocument>
+
+/*
+  Highlights files with the grammars of a bundle directory, several times
+  over. The first pass makes the rules and compiles the regexes reached,
+  the later ones should only search. Prints the time of each, the match
+  regions allocated, and how much of the grammar was made on the way,
+  compared to all of it.
+
+  Fails if a pass after the first allocates match regions, since the
+  highlighter is meant to reuse them once it's warmed up.
+  */
+
+namespace {
+
+const int DefaultPasses = 5;
+
+void _PrintUsage()
+{
+    QTextStream err(stderr);
+    err << "Usage: highlightbenchmark [--passes N] BUNDLE_DIR FILE...\n"
+        << "\n"
+        << "  --passes N   Highlight each file N times (default " << DefaultPasses << ", at least 2)\n";
+}
+
+/**
+  * Makes all the rules reachable in the table, and compiles their regexes
+  */
+void _MakeAllRules(const Grammar& grammar, GrammarData& data)
+{
+    QWriteLocker locker(&data.lock);
+    for (RuleId id = 0; id < data.rules.size(); id++)
+        grammar.resolveChildRules(data, id);
+}
+
+/**
+  * Returns false if a pass after the first allocated match regions
+  */
+bool _Benchmark(BundleManager& manager, const QString& fileName, int passes, QTextStream& out)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        out << fileName << ": can't be read\n";
+        return true;
+    }
+    const QString scopeName = manager.scopeNameForExtension(QFileInfo(fileName).completeSuffix());
+    if (scopeName.isNull()) {
+        out << fileName << ": no grammar\n";
+        return true;
+    }
+
+    QTextDocument document;
+    const QByteArray text = file.readAll();
+    document.setPlainText(QString::fromUtf8(text.constData(), text.size()));
+    Highlighter* highlighter = manager.getHighlighterForExtension(QFileInfo(fileName).completeSuffix(), &document);
+
+    // The same table as the highlighter's, while it's alive
+    Grammar grammar = manager.grammar();
+    GrammarDataPtr data = grammar.compile(scopeName);
+
+    out << fileName << ": " << document.blockCount() << " lines, " << scopeName << "\n";
+    int steadyAllocations = 0;
+    QElapsedTimer timer;
+    for (int pass = 0; pass < passes; pass++) {
+        const int allocations = Match::allocations();
+        timer.start();
+        highlighter->rehighlight();
+        const qint64 elapsed = timer.elapsed();
+        const int allocated = Match::allocations() - allocations;
+        if (pass > 0)
+            steadyAllocations += allocated;
+        out << "  pass " << pass + 1 << ": " << elapsed << " ms, "
+            << allocated << " match allocations\n";
+    }
+
+    int rulesMade;
+    int regexesMade;
+    {
+        QReadLocker locker(&data->lock);
+        rulesMade = data->rules.size();
+        regexesMade = data->regexCount;
+    }
+    _MakeAllRules(grammar, *data);
+    out << "  made on the way: " << rulesMade << " of " << data->rules.size() << " rules, "
+        << regexesMade << " of " << data->regexCount << " regexes\n";
+    delete highlighter;
+
+    if (steadyAllocations > 0) {
+        out << "  FAILED: " << steadyAllocations << " match allocations after the first pass\n";
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    // The text document needs fonts, but nothing is shown
+    QApplication app(argc, argv, false);
+
+    int passes = DefaultPasses;
+    QStringList paths;
+    QStringList args = app.arguments().mid(1);
+    while (!args.isEmpty()) {
+        const QString arg = args.takeFirst();
+        bool ok = true;
+        if (arg == "--passes" && !args.isEmpty()) {
+            passes = args.takeFirst().toInt(&ok);
+            ok = ok && passes >= 2;
+        } else if (arg.startsWith("-")) {
+            ok = false;
+        } else {
+            paths << arg;
+        }
+        if (!ok) {
+            _PrintUsage();
+            return 1;
+        }
+    }
+    if (paths.size() < 2) {
+        _PrintUsage();
+        return 1;
+    }
+
+    BundleManager manager;
+    manager.readBundles(paths.takeFirst());
+
+    QTextStream out(stdout);
+    bool ok = true;
+    foreach (const QString& fileName, paths)
+        ok = _Benchmark(manager, fileName, passes, out) && ok;
+    out << "Regexes compiled for all grammars: " << manager.grammar().regexCount() << "\n";
+    return ok ? 0 : 2;
+}
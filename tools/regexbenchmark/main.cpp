@@ -0,0 +1,371 @@
+#include "nativematcher.h"
+#include "pikevm.h"
+#include "regex.h"
+#include "regexengine.h"
+#include "regexsyntax.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QVector>
+
+#include <oniguruma.h>
+
+/*
+  Searches a fixed corpus of patterns and lines with Oniguruma, with each
+  regex engine on its own, and with Regex, which adds the literal and first
+  character filters. Lines are searched like the highlighter does, from the
+  start and then from the end of each match.
+
+  Every result must be the same as Oniguruma's, captures included. An
+  engine may leave a search to Oniguruma, which is counted but not compared.
+  Prints the time each engine takes for the searches it decides, against
+  Oniguruma on the same searches.
+  */
+
+namespace {
+
+const int DefaultRepeat = 20;
+const int MaxReportedDifferences = 20;
+
+const char* const Patterns[] = {
+    // Literals and keywords
+    "\\b(if|else|for|while|do|switch|case|return)\\b",
+    "\\b(?:true|false|null)\\b",
+    "//",
+    "/\\*",
+    "\\*/",
+    "#\\s*(include|define|ifdef|ifndef|endif)\\b",
+    "\\bclass\\b",
+    "<!--",
+    // Runs of a class
+    "\\s+",
+    "[ \\t]+$",
+    "\\w+",
+    "[A-Za-z_][A-Za-z0-9_]*",
+    "\\d+",
+    "[^\"\\\\]+",
+    // General patterns
+    "(//).*$\\n?",
+    "\"(?:[^\"\\\\]|\\\\.)*\"",
+    "'([^'\\\\]|\\\\.)'",
+    "\\b((0(x|X)[0-9a-fA-F]+)|([0-9]+(\\.[0-9]*)?([eE][+-]?[0-9]+)?))\\b",
+    "([A-Za-z_]\\w*)\\s*(\\()",
+    "^\\s*(def)\\s+([A-Za-z_]\\w*)\\s*\\(",
+    "(<)([a-zA-Z0-9:]+)(?=[^>]*></\\2>)",
+    "\\\\(x\\h{2}|[0-2][0-7]{0,2}|.)",
+    "(=|!|<|>)=?|&&|\\|\\|",
+    "\\G(\\s*)(\\w+)",
+    "[a-z]+?x",
+    "(a|ab)(c|bcd)(d*)",
+    "(?i)\\b(select|from|where)\\b",
+    "(?i)[a-f]+",
+    // Case folds to several characters
+    "(?i)strasse",
+    "(?i)stra\\u00dfe",
+    "(?i)ff",
+    "(?i)\\ufb01le",
+    "(?i)k",
+    // Non ASCII text
+    "\\u00e9+",
+    "[\\u0400-\\u04ff]+",
+    ".",
+};
+
+const char* const Lines[] = {
+    "",
+    "int main(int argc, char *argv[])",
+    "    if (x == 0x1F && y != 1.5e10) return foo(bar, \"baz \\\"qux\\\"\"); // done",
+    "/* a comment */ else { while (true) do_something(); }",
+    "#include <stdio.h>",
+    "  #  define MAX(a, b) ((a) > (b) ? (a) : (b))",
+    "def spam(eggs, ham):",
+    "<b></b> <i>text</i> <!-- comment -->",
+    "SELECT name FROM users WHERE id = '\\n' AND flag = '\\x41'",
+    "\t\t  trailing whitespace   ",
+    "abcd abcde aaaax deadbeef CAFE",
+    "Stra\\u00dfe STRASSE strasse \\ufb00 \\ufb01le file \\u212a",
+    "caf\\u00e9 \\u00e9\\u00e9 \\u041f\\u0440\\u0438\\u0432\\u0435\\u0442 mixed ASCII",
+    "surrogates \\ud83d\\ude00 in a line",
+};
+
+/**
+  * Replaces \uXXXX escapes, so the corpus stays ASCII in the source
+  */
+QString _Unescape(const char* text)
+{
+    const QString escaped = QString::fromLatin1(text);
+    QString result;
+    for (int i = 0; i < escaped.length(); i++) {
+        if (escaped.at(i) == '\\' && i + 5 < escaped.length() && escaped.at(i + 1) == 'u') {
+            bool ok;
+            const ushort c = escaped.mid(i + 2, 4).toUShort(&ok, 16);
+            if (ok) {
+                result += QChar(c);
+                i += 5;
+                continue;
+            }
+        }
+        result += escaped.at(i);
+    }
+    return result;
+}
+
+/**
+  * One search of the corpus, and Oniguruma's result. Captures are -1 for
+  * groups that didn't match, and empty if there was no match.
+  */
+struct Search {
+    int pattern;
+    int line;
+    int offset;
+    QVector<int> captures;
+};
+
+struct EngineFactory {
+    const char* name;
+    RegexEngineFactory create;
+};
+
+const EngineFactory Engines[] = {
+    { "native matcher", NativeMatcher::create },
+    { "pike vm", PikeVM::create },
+};
+const int EngineCount = sizeof(Engines) / sizeof(Engines[0]);
+
+struct EngineReport {
+    EngineReport() : patterns(0), searches(0), unknown(0), differences(0), time(0), onigTime(0) {}
+    int patterns;
+    int searches;
+    int unknown;
+    int differences;
+    qint64 time;
+    qint64 onigTime;
+};
+
+void _PrintUsage()
+{
+    QTextStream err(stderr);
+    err << "Usage: regexbenchmark [--repeat N] [FILE...]\n"
+        << "\n"
+        << "  --repeat N   Time each search N times (default " << DefaultRepeat << ")\n"
+        << "  FILE         Add the lines of the file to the corpus\n";
+}
+
+class OnigPattern
+{
+public:
+    explicit OnigPattern(const QString& pattern) : rx(0), region(onig_region_new()) {
+        OnigErrorInfo einfo;
+        const OnigUChar* p = reinterpret_cast<const OnigUChar*>(pattern.constData());
+        if (onig_new(&rx, p, p + pattern.length() * sizeof(QChar), ONIG_OPTION_CAPTURE_GROUP,
+                     ONIG_ENCODING_UTF16_LE, ONIG_SYNTAX_DEFAULT, &einfo) != ONIG_NORMAL)
+            rx = 0;
+    }
+    ~OnigPattern() { onig_free(rx); onig_region_free(region, 1); }
+
+    bool isValid() const { return rx != 0; }
+
+    /**
+      * Returns the captures of the match from offset, or an empty vector
+      */
+    QVector<int> search(const QString& line, int offset) const {
+        const OnigUChar* text = reinterpret_cast<const OnigUChar*>(line.constData());
+        const OnigUChar* end = text + line.length() * sizeof(QChar);
+        QVector<int> captures;
+        if (onig_search(rx, text, end, text + offset * sizeof(QChar), end, region, ONIG_OPTION_NONE) < 0)
+            return captures;
+        for (int i = 0; i < region->num_regs; i++) {
+            captures << (region->beg[i] < 0 ? -1 : region->beg[i] / int(sizeof(QChar)));
+            captures << (region->end[i] < 0 ? -1 : region->end[i] / int(sizeof(QChar)));
+        }
+        return captures;
+    }
+
+private:
+    OnigRegex rx;
+    OnigRegion* region;
+};
+
+QVector<int> _Captures(const Match& match)
+{
+    QVector<int> captures;
+    for (int i = 0; i < match.size(); i++) {
+        captures << (match.matched(i) ? match.pos(i) : -1);
+        captures << (match.matched(i) ? match.pos(i) + match.len(i) : -1);
+    }
+    return captures;
+}
+
+QString _Describe(const QString& pattern, const QString& line, int offset)
+{
+    return QString("/%1/ on \"%2\" from %3").arg(pattern, line).arg(offset);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int repeat = DefaultRepeat;
+    QStringList fileNames;
+    QStringList args = app.arguments().mid(1);
+    while (!args.isEmpty()) {
+        const QString arg = args.takeFirst();
+        bool ok = true;
+        if (arg == "--repeat" && !args.isEmpty()) {
+            repeat = args.takeFirst().toInt(&ok);
+            ok = ok && repeat > 0;
+        } else if (arg.startsWith("-")) {
+            ok = false;
+        } else {
+            fileNames << arg;
+        }
+        if (!ok) {
+            _PrintUsage();
+            return 1;
+        }
+    }
+
+    QStringList patterns;
+    for (uint i = 0; i < sizeof(Patterns) / sizeof(Patterns[0]); i++)
+        patterns << _Unescape(Patterns[i]);
+    QStringList lines;
+    for (uint i = 0; i < sizeof(Lines) / sizeof(Lines[0]); i++)
+        lines << _Unescape(Lines[i]);
+    foreach (const QString& fileName, fileNames) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly)) {
+            qWarning("Can't read %s", qPrintable(fileName));
+            return 1;
+        }
+        const QByteArray text = file.readAll();
+        lines += QString::fromUtf8(text.constData(), text.size()).split('\n');
+    }
+
+    // The searches the highlighter would do, with Oniguruma's results
+    QList<OnigPattern*> onig;
+    QVector<Search> searches;
+    for (int p = 0; p < patterns.size(); p++) {
+        onig << new OnigPattern(patterns.at(p));
+        if (!onig.last()->isValid()) {
+            qWarning("Invalid pattern %s", qPrintable(patterns.at(p)));
+            return 1;
+        }
+        for (int l = 0; l < lines.size(); l++) {
+            int offset = 0;
+            while (offset <= lines.at(l).length()) {
+                Search search;
+                search.pattern = p;
+                search.line = l;
+                search.offset = offset;
+                search.captures = onig.last()->search(lines.at(l), offset);
+                searches << search;
+                if (search.captures.isEmpty())
+                    break;
+                offset = qMax(search.captures.at(1), offset + 1);
+            }
+        }
+    }
+
+    QTextStream out(stdout);
+    int differences = 0;
+
+    // Each engine on its own, for the patterns it supports
+    QVector<EngineReport> reports(EngineCount);
+    for (int e = 0; e < EngineCount; e++) {
+        EngineReport& report = reports[e];
+        QVector<RegexEngine*> engines(patterns.size());
+        for (int p = 0; p < patterns.size(); p++) {
+            RegexParser parser;
+            RegexNodePtr root = parser.parse(patterns.at(p));
+            engines[p] = root ? Engines[e].create(root, parser.captureCount()) : 0;
+            if (engines[p])
+                report.patterns++;
+        }
+
+        QVector<int> captures;
+        foreach (const Search& search, searches) {
+            RegexEngine* engine = engines.at(search.pattern);
+            if (!engine)
+                continue;
+            const QString& line = lines.at(search.line);
+            const QChar* begin = line.constData();
+            const QChar* end = begin + line.length();
+            captures.resize(2 * (engine->captureCount() + 1));
+
+            RegexEngine::Result result = engine->search(begin, end, begin + search.offset, end, captures.data());
+            if (result == RegexEngine::Unknown) {
+                report.unknown++;
+                continue;
+            }
+            report.searches++;
+            if (result == RegexEngine::NotFound)
+                captures.clear();
+            if (captures != search.captures) {
+                if (++report.differences <= MaxReportedDifferences)
+                    qWarning("%s differs from Oniguruma for %s", Engines[e].name,
+                             qPrintable(_Describe(patterns.at(search.pattern), line, search.offset)));
+                continue;
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            for (int r = 0; r < repeat; r++)
+                engine->search(begin, end, begin + search.offset, end, captures.data());
+            report.time += timer.nsecsElapsed();
+            timer.start();
+            for (int r = 0; r < repeat; r++)
+                onig.at(search.pattern)->search(line, search.offset);
+            report.onigTime += timer.nsecsElapsed();
+        }
+        qDeleteAll(engines);
+
+        out << Engines[e].name << ": " << report.patterns << " of " << patterns.size() << " patterns, "
+            << report.searches << " searches, " << report.unknown << " left to Oniguruma, "
+            << report.differences << " different, "
+            << report.time / 1000 << " us vs " << report.onigTime / 1000 << " us in Oniguruma\n";
+        differences += report.differences;
+    }
+
+    // Regex, with the filters, and the engines where they apply
+    QList<Regex> regexes;
+    foreach (const QString& pattern, patterns)
+        regexes << Regex(pattern);
+    int regexDifferences = 0;
+    qint64 regexTime = 0;
+    qint64 onigTime = 0;
+    Match match;
+    foreach (const Search& search, searches) {
+        const QString& line = lines.at(search.line);
+        const Regex& regex = regexes.at(search.pattern);
+        QVector<int> captures;
+        if (regex.search(line.begin(), line.end(), line.begin() + search.offset, line.end(), match))
+            captures = _Captures(match);
+        if (captures != search.captures) {
+            if (++regexDifferences <= MaxReportedDifferences)
+                qWarning("Regex differs from Oniguruma for %s",
+                         qPrintable(_Describe(patterns.at(search.pattern), line, search.offset)));
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int r = 0; r < repeat; r++)
+            regex.search(line.begin(), line.end(), line.begin() + search.offset, line.end(), match);
+        regexTime += timer.nsecsElapsed();
+        timer.start();
+        for (int r = 0; r < repeat; r++)
+            onig.at(search.pattern)->search(line, search.offset);
+        onigTime += timer.nsecsElapsed();
+    }
+    out << "regex: " << searches.size() << " searches, " << regexDifferences << " different, "
+        << regexTime / 1000 << " us vs " << onigTime / 1000 << " us in Oniguruma\n";
+    differences += regexDifferences;
+
+    qDeleteAll(onig);
+    return differences == 0 ? 0 : 2;
+}
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Compares the regex engines with Oniguruma on a fixed corpus, and times
+# them
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = regexbenchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../src/src.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,177 @@
+#include "bundlemanager.h"
+#include "editor.h"
+#include "highlighter.h"
+#include "plistreader.h"
+#include "scopeselector.h"
+#include "theme.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QTextStream>
+#include <QtGui/QApplication>
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+/*
+  Highlights files with the grammars of a bundle directory, and times
+  looking up the theme formats of the scope stacks of all their tokens:
+  with a linear scan of the theme selectors, like Theme did before it had
+  an index, with the selector index, and with the format cache. The
+  results of the scan and the index are compared.
+  */
+
+namespace {
+
+const int DefaultRepeat = 10;
+
+void _PrintUsage()
+{
+    QTextStream err(stderr);
+    err << "Usage: themebenchmark [--repeat N] THEME_FILE BUNDLE_DIR FILE...\n"
+        << "\n"
+        << "  --repeat N   Look up the scopes of all tokens N times (default " << DefaultRepeat << ")\n";
+}
+
+QTextCharFormat _LinearFindFormat(const QMap<ScopeSelector, QTextCharFormat>& data, const ScopeSelector& scope)
+{
+    QTextCharFormat format;
+    QMap<ScopeSelector, QTextCharFormat>::const_iterator it;
+    for (it = data.begin(); it != data.end(); ++it) {
+        if (it.key().matches(scope)) {
+            QTextCharFormat old = format;
+            format = it.value();
+            format.merge(old);
+        }
+    }
+    return format;
+}
+
+/**
+  * Returns the scope stacks of the tokens of the file, in order
+  */
+QVector<ScopeStack> _ReadScopes(BundleManager& manager, const QString& fileName)
+{
+    QVector<ScopeStack> scopes;
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return scopes;
+
+    QTextDocument document;
+    const QByteArray text = file.readAll();
+    document.setPlainText(QString::fromUtf8(text.constData(), text.size()));
+    Highlighter* highlighter = manager.getHighlighterForExtension(QFileInfo(fileName).completeSuffix(), &document);
+    highlighter->rehighlight();
+    for (QTextBlock block = document.begin(); block.isValid(); block = block.next()) {
+        foreach (const ScopeStack& scope, EditorBlockData::forBlock(block)->scopes)
+            scopes << scope;
+    }
+    delete highlighter;
+    return scopes;
+}
+
+qint64 _NsecsPerLookup(qint64 nsecs, int lookups)
+{
+    return lookups > 0 ? nsecs / lookups : 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    // The text document needs fonts, but nothing is shown
+    QApplication app(argc, argv, false);
+
+    int repeat = DefaultRepeat;
+    QStringList paths;
+    QStringList args = app.arguments().mid(1);
+    while (!args.isEmpty()) {
+        const QString arg = args.takeFirst();
+        bool ok = true;
+        if (arg == "--repeat" && !args.isEmpty()) {
+            repeat = args.takeFirst().toInt(&ok);
+        } else if (arg.startsWith("-")) {
+            ok = false;
+        } else {
+            paths << arg;
+        }
+        if (!ok) {
+            _PrintUsage();
+            return 1;
+        }
+    }
+    if (paths.size() < 3) {
+        _PrintUsage();
+        return 1;
+    }
+
+    QScopedPointer<PlistStream> stream(PlistStream::open(paths.takeFirst()));
+    const ThemeData themeData = ThemeData::read(*stream);
+    QMap<ScopeSelector, QTextCharFormat> data;
+    typedef QPair<QString, QTextCharFormat> Format;
+    foreach (const Format& format, themeData.formats)
+        data[format.first] = format.second;
+
+    BundleManager manager;
+    manager.readBundles(paths.takeFirst());
+
+    QVector<ScopeStack> scopes;
+    foreach (const QString& fileName, paths)
+        scopes += _ReadScopes(manager, fileName);
+    QList<ScopeStack> distinct;
+    QSet<QString> seen;
+    foreach (const ScopeStack& scope, scopes) {
+        const QString names = ScopeAtoms::names(scope).join(" ");
+        if (!seen.contains(names)) {
+            seen.insert(names);
+            distinct << scope;
+        }
+    }
+
+    // The scope stacks are converted for each lookup, like on a cache miss
+    QElapsedTimer timer;
+    timer.start();
+    for (int r = 0; r < repeat; r++) {
+        foreach (const ScopeStack& scope, scopes)
+            _LinearFindFormat(data, ScopeSelector(scope));
+    }
+    const qint64 linearTime = timer.nsecsElapsed();
+
+    Theme theme;
+    theme.setThemeData(themeData);
+    timer.start();
+    for (int r = 0; r < repeat; r++) {
+        foreach (const ScopeStack& scope, scopes)
+            theme.findFormat(ScopeSelector(scope));
+    }
+    const qint64 indexTime = timer.nsecsElapsed();
+
+    timer.start();
+    for (int r = 0; r < repeat; r++) {
+        foreach (const ScopeStack& scope, scopes)
+            theme.findFormat(scope);
+    }
+    const qint64 cacheTime = timer.nsecsElapsed();
+
+    int mismatches = 0;
+    foreach (const ScopeStack& scope, distinct) {
+        if (_LinearFindFormat(data, ScopeSelector(scope)) != theme.findFormat(ScopeSelector(scope))) {
+            qWarning("Formats differ for %s", qPrintable(ScopeAtoms::names(scope).join(" ")));
+            mismatches++;
+        }
+    }
+
+    const int lookups = scopes.size() * repeat;
+    QTextStream out(stdout);
+    out << scopes.size() << " tokens, " << distinct.size() << " distinct scope stacks, "
+        << data.size() << " theme selectors\n"
+        << "linear scan: " << _NsecsPerLookup(linearTime, lookups) << " ns per lookup\n"
+        << "index:       " << _NsecsPerLookup(indexTime, lookups) << " ns per lookup\n"
+        << "cache:       " << _NsecsPerLookup(cacheTime, lookups) << " ns per lookup, "
+        << theme.formatCacheHits() << " hits, " << theme.formatCacheMisses() << " misses, "
+        << theme.formatCacheSize() << " scope stacks cached\n"
+        << mismatches << " scope stacks with different formats\n";
+    return mismatches == 0 ? 0 : 2;
+}
@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# Times theme format lookups on the scopes of highlighted files
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = themebenchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../../src/src.pri)
+
+SOURCES += main.cpp